@@ -0,0 +1,13 @@
+# Pose kernels pick their instruction set at compile time: AVX2 when the
+# compiler targets it, SSE2 on any x86-64 build, scalar code elsewhere.
+# The BMP decoder needs SSSE3 shuffles, which AVX2 builds include; mip
+# chains of textures are averaged with SSE2.
+OPTION(USE_AVX2 "Build the pose kernels for AVX2" OFF)
+IF (USE_AVX2)
+	IF (${CMAKE_CXX_COMPILER_ID} STREQUAL MSVC)
+		SET(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /arch:AVX2")
+	ELSE ()
+		SET(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -mavx2")
+	ENDIF ()
+	MESSAGE(STATUS "Pose kernels: AVX2")
+ENDIF ()
@@ -0,0 +1,3 @@
+# Animations are saved on a worker thread.
+FIND_PACKAGE(Threads REQUIRED)
+LIST(APPEND stdgl_libraries ${CMAKE_THREAD_LIBS_INIT})
@@ -2,100 +2,120 @@
 // bitmap.cpp
 //
 // handle MS bitmap I/O. For portability, we don't use the data structure defined in Windows.h
-// However, there is some strange thing, the side of our structure is different from what it 
-// should though we define it in the same way as MS did. So, there is a hack, we use the hardcoded
-// constanr, 14, instead of the sizeof to calculate the size of the structure.
-// You are not supposed to worry about this part. However, I will appreciate if you find out the
-// reason and let me know. Thanks.
+// The headers are read field by field at their offsets in the file: on disk the file header
+// is 14 bytes, but the compiler pads BMP_BITMAPFILEHEADER after bfType.
 //
 
 #include "bitmap.h"
 #include "image.h"
- 
-BMP_BITMAPFILEHEADER bmfh; 
-BMP_BITMAPINFOHEADER bmih; 
+#include <vector>
 
-bool readBMP(const char *fname, Image& image)
-{ 
-	FILE* file; 
-	BMP_DWORD pos; 
- 
-	if ( (file=fopen( fname, "rb" )) == NULL )  
-		return false; 
-	 
-//	I am doing fread( &bmfh, sizeof(BMP_BITMAPFILEHEADER), 1, file ) in a safe way. :}
-	auto ret = fread( &(bmfh.bfType), 2, 1, file); 
-	ret += fread( &(bmfh.bfSize), 4, 1, file); 
-	ret += fread( &(bmfh.bfReserved1), 2, 1, file); 
-	ret += fread( &(bmfh.bfReserved2), 2, 1, file); 
-	ret += fread( &(bmfh.bfOffBits), 4, 1, file); 
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
 
-	pos = bmfh.bfOffBits; 
- 
-	ret += fread( &bmih, sizeof(BMP_BITMAPINFOHEADER), 1, file ); 
+namespace {
+
+const size_t kFileHeaderSize = 14; // sizeof(BMP_BITMAPFILEHEADER) would include padding
 
-	if (ret == 0)
-		return false;
- 
-	// error checking
-	if ( bmfh.bfType!= 0x4d42 ) {	// "BM" actually
-		return false;
-	}
-	if ( bmih.biBitCount != 24 )  
-		return false; 
 /*
- 	if ( bmih.biCompression != BMP_BI_RGB ) {
-		return NULL;
+ * BGR pixels of a row to RGBA with alpha 255.
+ */
+void swizzleRow(const unsigned char* in, unsigned char* out, int width)
+{
+	int i = 0;
+#if defined(__SSSE3__) || defined(__AVX__)
+	// 16 pixels are 48 bytes in and 64 bytes out. Every 12 byte group
+	// holds 4 pixels, which one shuffle spreads over 16 bytes; its zeroed
+	// alpha bytes are then set.
+	const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+	                                    8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+	for (; i + 16 <= width; i += 16) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 32));
+		__m128i p0 = a;
+		__m128i p1 = _mm_alignr_epi8(b, a, 12);
+		__m128i p2 = _mm_alignr_epi8(c, b, 8);
+		__m128i p3 = _mm_srli_si128(c, 4);
+		__m128i* dst = reinterpret_cast<__m128i*>(out);
+		_mm_storeu_si128(dst + 0, _mm_or_si128(_mm_shuffle_epi8(p0, order), alpha));
+		_mm_storeu_si128(dst + 1, _mm_or_si128(_mm_shuffle_epi8(p1, order), alpha));
+		_mm_storeu_si128(dst + 2, _mm_or_si128(_mm_shuffle_epi8(p2, order), alpha));
+		_mm_storeu_si128(dst + 3, _mm_or_si128(_mm_shuffle_epi8(p3, order), alpha));
+		in += 48;
+		out += 64;
 	}
-*/
-	fseek( file, pos, SEEK_SET ); 
- 
-	int width = image.width = bmih.biWidth; 
-	int height = image.height = bmih.biHeight; 
- 
-	int padWidth = width * 3; 
-	int pad = 0; 
-	if ( padWidth % 4 != 0 ) { 
-		pad = 4 - (padWidth % 4); 
-		padWidth += pad; 
-	} 
-	int bytes = height*padWidth; 
-	image.stride = padWidth;
- 
-	image.bytes.resize(bytes);
-	unsigned char *data = image.bytes.data();
-
-	int foo = fread( data, bytes, 1, file ); 
-	
-	if (!foo) {
-		return false;
+#endif
+	for (; i < width; i++) {
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		out[3] = 0xFF;
+		in += 3;
+		out += 4;
 	}
+}
 
-	fclose( file );
-	
-	// shuffle bitmap data such that it is (R,G,B) tuples in row-major order
-	int i, j;
-	j = 0;
-	unsigned char temp;
-	unsigned char* in;
-	unsigned char* out;
+BMP_WORD readWord(const unsigned char* p)
+{
+	return BMP_WORD(p[0] | (p[1] << 8));
+}
 
-	in = data;
-	out = data;
+BMP_DWORD readDword(const unsigned char* p)
+{
+	return BMP_DWORD(p[0]) | (BMP_DWORD(p[1]) << 8) | (BMP_DWORD(p[2]) << 16) | (BMP_DWORD(p[3]) << 24);
+}
 
-	for ( j = 0; j < height; ++j )
-	{
-		for ( i = 0; i < width; ++i )
-		{
-			out[1] = in[1];
-			temp = in[2];
-			out[2] = in[0];
-			out[0] = temp;
+}
 
-			in += 3;
-			out += 3;
-		}
-		in += pad;
+bool decodeBMP(const unsigned char* data, size_t size, Image& image)
+{
+	if (size < kFileHeaderSize + 40 || readWord(data) != 0x4d42) // "BM" actually
+		return false;
+	BMP_DWORD offset = readDword(data + 10);
+	const unsigned char* info = data + kFileHeaderSize;
+	BMP_LONG width = BMP_LONG(readDword(info + 4));
+	BMP_LONG height = BMP_LONG(readDword(info + 8));
+	BMP_WORD bit_count = readWord(info + 14);
+	BMP_DWORD compression = readDword(info + 16);
+	if (bit_count != 24 || compression != BMP_BI_RGB || width <= 0 || height == 0 ||
+	    width > 65536 || height > 65536 || height < -65536)
+		return false;
+	// Rows are stored bottom up unless the height is negative. Either
+	// way the image keeps the bottom row first.
+	bool top_down = height < 0;
+	int rows = top_down ? -height : height;
+	size_t pitch = (size_t(width) * 3 + 3) / 4 * 4;
+	if (offset > size || (size - offset) < pitch * (rows - 1) + size_t(width) * 3)
+		return false;
+
+	image.width = width;
+	image.height = rows;
+	image.stride = width * 4;
+	image.bytes.resize(size_t(image.stride) * rows);
+	for (int row = 0; row < rows; row++) {
+		int src = top_down ? rows - 1 - row : row;
+		swizzleRow(data + offset + pitch * src, image.bytes.data() + size_t(image.stride) * row, width);
 	}
 	return true;
-} 
+}
+
+bool readBMP(const char *fname, Image& image)
+{ 
+	FILE* file = fopen(fname, "rb");
+	if (!file)
+		return false;
+	std::vector<unsigned char> data;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		long size = ftell(file);
+		if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+			data.resize(size_t(size));
+			if (fread(data.data(), data.size(), 1, file) != 1)
+				data.clear();
+		}
+	}
+	fclose(file);
+	return decodeBMP(data.data(), data.size(), image);
+}
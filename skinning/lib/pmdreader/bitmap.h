@@ -40,7 +40,13 @@ typedef struct {
 } BMP_BITMAPINFOHEADER; 
 
 struct Image;
-// global I/O routines
+// global I/O routines, safe to call from several threads
+//
+// Decodes a 24-bit uncompressed bitmap held in memory, e.g. a mapped
+// file, into tightly packed RGBA rows with alpha 255 (stride is
+// 4 * width), bottom row first, ready for glTexSubImage2D.
+extern bool decodeBMP(const unsigned char* data, size_t size, Image& image);
+// Reads the file and decodes it as above.
 extern bool readBMP(const char *fname, Image& image);
 //int& width, int& height, void* data_ptr);
 
@@ -61,6 +61,10 @@
 
 #ifndef MMD_WINDOWS
 #include <iconv.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #include "util/dwarf.inl"
@@ -74,6 +78,7 @@ namespace mmd {
     typedef Matrix4x4<float> Matrix4f;
 
     typedef Bezier<float> interpolator;
+    typedef BezierTable<float> interpolator_table;
 
     namespace {
         const size_t nil = size_t(-1);
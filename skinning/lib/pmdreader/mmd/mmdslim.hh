@@ -60,6 +60,10 @@
 
 #ifndef MMD_WINDOWS
 #include <iconv.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #include "util/dwarf.inl"
@@ -73,6 +77,7 @@ namespace mmd {
     typedef Matrix4x4<float> Matrix4f;
 
     typedef Bezier<float> interpolator;
+    typedef BezierTable<float> interpolator_table;
 
     namespace {
         const size_t nil = size_t(-1);
@@ -667,11 +667,13 @@ namespace mmd {
         Vertex<cref> GetVertex(size_t index) const;
         Vertex<ref> GetVertex(size_t index);
         Vertex<ref> NewVertex();
+        void ReserveVertices(size_t vertex_num);
 
         size_t GetTriangleNum() const;
         const Vector3D<std::uint32_t> &GetTriangle(size_t index) const;
         Vector3D<std::uint32_t> &GetTriangle(size_t index);
         Vector3D<std::uint32_t> &NewTriangle();
+        void ReserveTriangles(size_t triangle_num);
 
         size_t GetPartNum() const;
         const Part &GetPart(size_t index) const;
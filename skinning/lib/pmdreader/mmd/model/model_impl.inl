@@ -225,6 +225,18 @@ Model::NewVertex() {
     return GetVertex(GetVertexNum()-1);
 }
 
+inline void
+Model::ReserveVertices(size_t vertex_num) {
+    vertex_info_.coordinates_.reserve(vertex_num);
+    vertex_info_.normals_.reserve(vertex_num);
+    vertex_info_.uv_coords_.reserve(vertex_num);
+    for(size_t i=0;i<GetExtraUVNumber();++i) {
+        vertex_info_.extra_uv_coords_[i].reserve(vertex_num);
+    }
+    vertex_info_.skinning_operators_.reserve(vertex_num);
+    vertex_info_.edge_scales_.reserve(vertex_num);
+}
+
 //// omember: triangle
 inline size_t
 Model::GetTriangleNum() const {
@@ -247,6 +259,11 @@ Model::NewTriangle() {
     return triangles_.back();
 }
 
+inline void
+Model::ReserveTriangles(size_t triangle_num) {
+    triangles_.reserve(triangle_num);
+}
+
 //// omember: part
 inline size_t
 Model::GetPartNum() const {
@@ -11,6 +11,8 @@
 
 namespace mmd {
 
+    class CompiledMotion;
+
     class Motion {
     public:
         class BonePose {
@@ -31,44 +33,52 @@ namespace mmd {
             float weight_;
         };
 
+        /*
+         * Keyframes refer to their curves by index into the curve table of
+         * their Motion; a new keyframe is linear.
+         */
         class BoneKeyframe {
         public:
+            BoneKeyframe();
+
             const Vector3f &GetTranslation() const;
             void SetTranslation(const Vector3f &translation);
 
             const Vector4f &GetRotation() const;
             void SetRotation(const Vector4f &rotation);
 
-            const interpolator &GetXInterpolator() const;
-            interpolator &GetXInterpolator();
-            const interpolator &GetYInterpolator() const;
-            interpolator &GetYInterpolator();
-            const interpolator &GetZInterpolator() const;
-            interpolator &GetZInterpolator();
-            const interpolator &GetRInterpolator() const;
-            interpolator &GetRInterpolator();
+            interpolator_table::index_type GetXCurve() const;
+            void SetXCurve(interpolator_table::index_type curve);
+            interpolator_table::index_type GetYCurve() const;
+            void SetYCurve(interpolator_table::index_type curve);
+            interpolator_table::index_type GetZCurve() const;
+            void SetZCurve(interpolator_table::index_type curve);
+            interpolator_table::index_type GetRCurve() const;
+            void SetRCurve(interpolator_table::index_type curve);
 
         private:
             Vector3f translation_;
             Vector4f rotation_;
 
-            interpolator x_interpolator_;
-            interpolator y_interpolator_;
-            interpolator z_interpolator_;
-            interpolator r_interpolator_;
+            interpolator_table::index_type x_curve_;
+            interpolator_table::index_type y_curve_;
+            interpolator_table::index_type z_curve_;
+            interpolator_table::index_type r_curve_;
         };
 
         class MorphKeyframe {
         public:
+            MorphKeyframe();
+
             float GetWeight() const;
             void SetWeight(float weight);
 
-            const interpolator &GetWeightInterpolator() const;
-            interpolator &GetWeightInterpolator();
+            interpolator_table::index_type GetWeightCurve() const;
+            void SetWeightCurve(interpolator_table::index_type curve);
 
         private:
             float weight_;
-            interpolator w_interpolator_;
+            interpolator_table::index_type w_curve_;
         };
 
         Motion();
@@ -76,6 +86,9 @@ namespace mmd {
         const std::wstring &GetName() const;
         void SetName(const std::wstring &name);
 
+        const interpolator_table &GetCurves() const;
+        interpolator_table &GetCurves();
+
         const BoneKeyframe &GetBoneKeyframe(
             const std::wstring &bone_name, size_t frame
         ) const;
@@ -123,12 +136,64 @@ namespace mmd {
         void Clear();
 
     private:
+        friend class CompiledMotion;
+
         std::wstring name_;
         size_t length_;
+        interpolator_table curves_;
         std::map<std::wstring, std::map<size_t, BoneKeyframe>> bone_motions_;
         std::map<std::wstring, std::map<size_t, MorphKeyframe>> morph_motions_;
     };
 
+    /*
+     * Motion flattened for playback on one model. There is a track for
+     * every bone and morph of the model, indexed by its ID; a track keeps
+     * its keyframe frames and values in arrays shared by all tracks, so
+     * sampling takes neither a name lookup nor a map traversal. The
+     * cursor passed to GetBonePose/GetMorphPose remembers the keyframe
+     * the last sample of that track fell after, so sampling forward in
+     * time only looks at the next keyframe.
+     * Poses are those of Motion::GetBonePose/GetMorphPose.
+     */
+    class CompiledMotion {
+    public:
+        CompiledMotion(const Motion &motion, const Model &model);
+
+        bool IsBoneAnimated(size_t bone_id) const;
+        bool IsMorphAnimated(size_t morph_id) const;
+
+        Motion::BonePose GetBonePose(
+            size_t bone_id, double frame, size_t &cursor
+        ) const;
+        Motion::MorphPose GetMorphPose(
+            size_t morph_id, double frame, size_t &cursor
+        ) const;
+
+        size_t GetLength() const;
+
+    private:
+        static bool Locate(
+            const std::vector<size_t> &frames, size_t begin, size_t end,
+            double frame, size_t &cursor, size_t &left, float &bary_pos
+        );
+
+        size_t length_;
+        interpolator_table curves_;
+
+        std::vector<bool> bone_animated_;
+        std::vector<size_t> bone_track_begin_;
+        std::vector<size_t> bone_frames_;
+        std::vector<Vector3f> bone_translations_;
+        std::vector<Vector4f> bone_rotations_;
+        std::vector<interpolator_table::index_type> bone_curves_; // x, y, z, r for every keyframe
+
+        std::vector<bool> morph_animated_;
+        std::vector<size_t> morph_track_begin_;
+        std::vector<size_t> morph_frames_;
+        std::vector<float> morph_weights_;
+        std::vector<interpolator_table::index_type> morph_curves_;
+    };
+
     class Pose {
     public:
         // TODO - pose related features
@@ -30,6 +30,10 @@ Motion::MorphPose::GetWeight() const {
     return weight_;
 }
 
+inline
+Motion::BoneKeyframe::BoneKeyframe()
+  : x_curve_(0), y_curve_(0), z_curve_(0), r_curve_(0) {}
+
 inline const Vector3f&
 Motion::BoneKeyframe::GetTranslation() const {
     return translation_;
@@ -50,46 +54,50 @@ Motion::BoneKeyframe::SetRotation(const Vector4f &rotation) {
     rotation_ = rotation;
 }
 
-inline const interpolator&
-Motion::BoneKeyframe::GetXInterpolator() const {
-    return x_interpolator_;
+inline interpolator_table::index_type
+Motion::BoneKeyframe::GetXCurve() const {
+    return x_curve_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetXInterpolator() {
-    return x_interpolator_;
+inline void
+Motion::BoneKeyframe::SetXCurve(interpolator_table::index_type curve) {
+    x_curve_ = curve;
 }
 
-inline const interpolator&
-Motion::BoneKeyframe::GetYInterpolator() const {
-    return y_interpolator_;
+inline interpolator_table::index_type
+Motion::BoneKeyframe::GetYCurve() const {
+    return y_curve_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetYInterpolator() {
-    return y_interpolator_;
+inline void
+Motion::BoneKeyframe::SetYCurve(interpolator_table::index_type curve) {
+    y_curve_ = curve;
 }
 
-inline const interpolator&
-Motion::BoneKeyframe::GetZInterpolator() const {
-    return z_interpolator_;
+inline interpolator_table::index_type
+Motion::BoneKeyframe::GetZCurve() const {
+    return z_curve_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetZInterpolator() {
-    return z_interpolator_;
+inline void
+Motion::BoneKeyframe::SetZCurve(interpolator_table::index_type curve) {
+    z_curve_ = curve;
 }
 
-inline const interpolator&
-Motion::BoneKeyframe::GetRInterpolator() const {
-    return r_interpolator_;
+inline interpolator_table::index_type
+Motion::BoneKeyframe::GetRCurve() const {
+    return r_curve_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetRInterpolator() {
-    return r_interpolator_;
+inline void
+Motion::BoneKeyframe::SetRCurve(interpolator_table::index_type curve) {
+    r_curve_ = curve;
 }
 
+inline
+Motion::MorphKeyframe::MorphKeyframe()
+  : weight_(0.0f), w_curve_(0) {}
+
 inline float
 Motion::MorphKeyframe::GetWeight() const {
     return weight_;
@@ -100,14 +108,14 @@ Motion::MorphKeyframe::SetWeight(float weight) {
     weight_ = weight;
 }
 
-inline const interpolator&
-Motion::MorphKeyframe::GetWeightInterpolator() const {
-    return w_interpolator_;
+inline interpolator_table::index_type
+Motion::MorphKeyframe::GetWeightCurve() const {
+    return w_curve_;
 }
 
-inline interpolator&
-Motion::MorphKeyframe::GetWeightInterpolator() {
-    return w_interpolator_;
+inline void
+Motion::MorphKeyframe::SetWeightCurve(interpolator_table::index_type curve) {
+    w_curve_ = curve;
 }
 
 inline void
@@ -213,6 +221,16 @@ Motion::SetName(const std::wstring &name) {
     name_ = name;
 }
 
+inline const interpolator_table&
+Motion::GetCurves() const {
+    return curves_;
+}
+
+inline interpolator_table&
+Motion::GetCurves() {
+    return curves_;
+}
+
 inline const Motion::BoneKeyframe&
 Motion::GetBoneKeyframe(const std::wstring &bone_name, size_t frame) const {
     return bone_motions_.find(bone_name)->second.find(frame)->second;
@@ -248,6 +266,7 @@ inline void
 Motion::Clear() {
     name_.clear();
     length_ = 0;
+    curves_ = interpolator_table();
     bone_motions_.clear();
     morph_motions_.clear();
 }
@@ -299,17 +318,17 @@ Motion::GetBonePose(const std::wstring &bone_name, size_t frame) const {
                 Vector3f translation;
                 Vector4f rotation;
 
-                lambda = left_key.GetXInterpolator()[bary_pos];
+                lambda = curves_(left_key.GetXCurve(), bary_pos);
                 translation.p.x
                     = l_translation.p.x*(1-lambda)+r_translation.p.x*lambda;
-                lambda = left_key.GetYInterpolator()[bary_pos];
+                lambda = curves_(left_key.GetYCurve(), bary_pos);
                 translation.p.y
                     = l_translation.p.y*(1-lambda)+r_translation.p.y*lambda;
-                lambda = left_key.GetZInterpolator()[bary_pos];
+                lambda = curves_(left_key.GetZCurve(), bary_pos);
                 translation.p.z
                     = l_translation.p.z*(1-lambda)+r_translation.p.z*lambda;
 
-                lambda = left_key.GetRInterpolator()[bary_pos];
+                lambda = curves_(left_key.GetRCurve(), bary_pos);
                 rotation = NLerp(l_rotation, r_rotation)[lambda];
 
                 return BonePose(translation, rotation);
@@ -361,17 +380,17 @@ Motion::GetBonePose(const std::wstring &bone_name, double time) const {
             Vector3f translation;
             Vector4f rotation;
 
-            lambda = left_key.GetXInterpolator()[bary_pos];
+            lambda = curves_(left_key.GetXCurve(), bary_pos);
             translation.p.x
                 = l_translation.p.x*(1-lambda)+r_translation.p.x*lambda;
-            lambda = left_key.GetYInterpolator()[bary_pos];
+            lambda = curves_(left_key.GetYCurve(), bary_pos);
             translation.p.y
                 = l_translation.p.y*(1-lambda)+r_translation.p.y*lambda;
-            lambda = left_key.GetZInterpolator()[bary_pos];
+            lambda = curves_(left_key.GetZCurve(), bary_pos);
             translation.p.z
                 = l_translation.p.z*(1-lambda)+r_translation.p.z*lambda;
 
-            lambda = left_key.GetRInterpolator()[bary_pos];
+            lambda = curves_(left_key.GetRCurve(), bary_pos);
             rotation = NLerp(l_rotation, r_rotation)[lambda];
 
             return BonePose(translation, rotation);
@@ -415,7 +434,7 @@ Motion::GetMorphPose(const std::wstring &morph_name, size_t frame) const {
 
                 float l_weight = left_key.GetWeight();
                 float r_weight = right_key.GetWeight();
-                float lambda = left_key.GetWeightInterpolator()[bary_pos];
+                float lambda = curves_(left_key.GetWeightCurve(), bary_pos);
 
                 return MorphPose(l_weight*(1-lambda)+r_weight*lambda);
             }
@@ -457,9 +476,172 @@ Motion::GetMorphPose(const std::wstring &morph_name, double time) const {
 
             float l_weight = left_key.GetWeight();
             float r_weight = right_key.GetWeight();
-            float lambda = left_key.GetWeightInterpolator()[bary_pos];
+            float lambda = curves_(left_key.GetWeightCurve(), bary_pos);
 
             return MorphPose(l_weight*(1-lambda)+r_weight*lambda);
         }
     }
 }
+
+inline
+CompiledMotion::CompiledMotion(const Motion &motion, const Model &model)
+  : length_(motion.GetLength()), curves_(motion.GetCurves()) {
+    size_t bone_num = model.GetBoneNum();
+    bone_animated_.assign(bone_num, false);
+    bone_track_begin_.reserve(bone_num+1);
+    for(size_t i=0;i<bone_num;++i) {
+        bone_track_begin_.push_back(bone_frames_.size());
+        std::map<std::wstring, std::map<size_t, Motion::BoneKeyframe>>::const_iterator track
+            = motion.bone_motions_.find(model.GetBone(i).GetName());
+        if(track==motion.bone_motions_.end()) {
+            continue;
+        }
+        bone_animated_[i] = true;
+        for(std::map<size_t, Motion::BoneKeyframe>::const_iterator j=track->second.begin();j!=track->second.end();++j) {
+            const Motion::BoneKeyframe &key = j->second;
+            bone_frames_.push_back(j->first);
+            bone_translations_.push_back(key.GetTranslation());
+            bone_rotations_.push_back(key.GetRotation());
+            bone_curves_.push_back(key.GetXCurve());
+            bone_curves_.push_back(key.GetYCurve());
+            bone_curves_.push_back(key.GetZCurve());
+            bone_curves_.push_back(key.GetRCurve());
+        }
+    }
+    bone_track_begin_.push_back(bone_frames_.size());
+
+    size_t morph_num = model.GetMorphNum();
+    morph_animated_.assign(morph_num, false);
+    morph_track_begin_.reserve(morph_num+1);
+    for(size_t i=0;i<morph_num;++i) {
+        morph_track_begin_.push_back(morph_frames_.size());
+        std::map<std::wstring, std::map<size_t, Motion::MorphKeyframe>>::const_iterator track
+            = motion.morph_motions_.find(model.GetMorph(i).GetName());
+        if(track==motion.morph_motions_.end()) {
+            continue;
+        }
+        morph_animated_[i] = true;
+        for(std::map<size_t, Motion::MorphKeyframe>::const_iterator j=track->second.begin();j!=track->second.end();++j) {
+            morph_frames_.push_back(j->first);
+            morph_weights_.push_back(j->second.GetWeight());
+            morph_curves_.push_back(j->second.GetWeightCurve());
+        }
+    }
+    morph_track_begin_.push_back(morph_frames_.size());
+}
+
+inline bool
+CompiledMotion::IsBoneAnimated(size_t bone_id) const {
+    return bone_animated_[bone_id];
+}
+
+inline bool
+CompiledMotion::IsMorphAnimated(size_t morph_id) const {
+    return morph_animated_[morph_id];
+}
+
+inline size_t
+CompiledMotion::GetLength() const {
+    return length_;
+}
+
+/*
+ * Finds the keyframe in [begin, end) that frame falls after, as an
+ * offset from begin, and how far frame is towards the next one. Returns
+ * false if frame is not strictly inside the track, leaving left at the
+ * keyframe to hold.
+ */
+inline bool
+CompiledMotion::Locate(
+    const std::vector<size_t> &frames, size_t begin, size_t end,
+    double frame, size_t &cursor, size_t &left, float &bary_pos
+) {
+    if(frames[begin]>=frame) {
+        cursor = 0;
+        left = begin;
+        return false;
+    }
+    if(frames[end-1]<=frame) {
+        cursor = end-1-begin;
+        left = end-1;
+        return false;
+    }
+    size_t i = begin+cursor;
+    if(i>=end-1 || frames[i]>frame) {
+        i = std::upper_bound(frames.begin()+begin, frames.begin()+end, frame)-frames.begin()-1;
+    } else if(frames[i+1]<=frame) {
+        ++i;
+        if(frames[i+1]<=frame) {
+            i = std::upper_bound(frames.begin()+i+1, frames.begin()+end, frame)-frames.begin()-1;
+        }
+    }
+    cursor = i-begin;
+    left = i;
+    if(frames[i]==frame) {
+        return false;
+    }
+    bary_pos = (float)((frame-frames[i])/(frames[i+1]-frames[i]));
+    return true;
+}
+
+inline Motion::BonePose
+CompiledMotion::GetBonePose(size_t bone_id, double frame, size_t &cursor) const {
+    size_t begin = bone_track_begin_[bone_id];
+    size_t end = bone_track_begin_[bone_id+1];
+
+    if(begin==end) {
+        Vector4f rot;
+        rot.q.MakeIdentity();
+        return Motion::BonePose(Vector3f(), rot);
+    }
+
+    size_t left;
+    float bary_pos;
+    if(!Locate(bone_frames_, begin, end, frame, cursor, left, bary_pos)) {
+        return Motion::BonePose(bone_translations_[left], bone_rotations_[left]);
+    }
+
+    const Vector3f& l_translation = bone_translations_[left];
+    const Vector4f& l_rotation = bone_rotations_[left];
+    const Vector3f& r_translation = bone_translations_[left+1];
+    const Vector4f& r_rotation = bone_rotations_[left+1];
+    float bary[4] = { bary_pos, bary_pos, bary_pos, bary_pos };
+    float lambda[4];
+    curves_.Evaluate(&bone_curves_[4*left], bary, lambda, 4);
+
+    Vector3f translation;
+    Vector4f rotation;
+
+    translation.p.x
+        = l_translation.p.x*(1-lambda[0])+r_translation.p.x*lambda[0];
+    translation.p.y
+        = l_translation.p.y*(1-lambda[1])+r_translation.p.y*lambda[1];
+    translation.p.z
+        = l_translation.p.z*(1-lambda[2])+r_translation.p.z*lambda[2];
+
+    rotation = NLerp(l_rotation, r_rotation)[lambda[3]];
+
+    return Motion::BonePose(translation, rotation);
+}
+
+inline Motion::MorphPose
+CompiledMotion::GetMorphPose(size_t morph_id, double frame, size_t &cursor) const {
+    size_t begin = morph_track_begin_[morph_id];
+    size_t end = morph_track_begin_[morph_id+1];
+
+    if(begin==end) {
+        return Motion::MorphPose(0.0f);
+    }
+
+    size_t left;
+    float bary_pos;
+    if(!Locate(morph_frames_, begin, end, frame, cursor, left, bary_pos)) {
+        return Motion::MorphPose(morph_weights_[left]);
+    }
+
+    float l_weight = morph_weights_[left];
+    float r_weight = morph_weights_[left+1];
+    float lambda = curves_(morph_curves_[left], bary_pos);
+
+    return Motion::MorphPose(l_weight*(1-lambda)+r_weight*lambda);
+}
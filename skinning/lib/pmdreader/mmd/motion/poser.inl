@@ -190,11 +190,13 @@ namespace mmd {
     private:
         MotionPlayer &operator=(const MotionPlayer&);
 
-        std::vector<std::pair<std::wstring, size_t>> bone_map_;
-        std::vector<std::pair<std::wstring, size_t>> morph_map_;
-
-        const Motion &motion_;
+        CompiledMotion motion_;
         Poser &poser_;
+
+        std::vector<size_t> bones_;
+        std::vector<size_t> morphs_;
+        std::vector<size_t> bone_cursors_;
+        std::vector<size_t> morph_cursors_;
     };
 
 #include "poser_impl.inl"
@@ -519,37 +519,38 @@ inline void Poser::MaterialImage::Init(float value) {
     diffuse_ = specular_ = ambient_ = edge_color_ = texture_ = sub_texture_ = toon_texture_ = seed;
 }
 
-inline MotionPlayer::MotionPlayer(const Motion& motion, Poser& poser) : motion_(motion), poser_(poser) {
+inline MotionPlayer::MotionPlayer(const Motion& motion, Poser& poser) : motion_(motion, poser.GetModel()), poser_(poser) {
     const Model& model = poser_.GetModel();
     for(size_t i=0;i<model.GetBoneNum();++i) {
-        const std::wstring &name = model.GetBone(i).GetName();
-        if(motion_.IsBoneRegistered(name)) {
-            bone_map_.push_back(std::make_pair(name, i));
+        if(motion_.IsBoneAnimated(i)) {
+            bones_.push_back(i);
         }
     }
+    bone_cursors_.assign(bones_.size(), 0);
 
     for(size_t i=0;i<model.GetMorphNum();++i) {
-        const std::wstring &name = model.GetMorph(i).GetName();
-        if(motion_.IsMorphRegistered(name)) {
-            morph_map_.push_back(std::make_pair(name, i));
+        if(motion_.IsMorphAnimated(i)) {
+            morphs_.push_back(i);
         }
     }
+    morph_cursors_.assign(morphs_.size(), 0);
 }
 
 inline void MotionPlayer::SeekFrame(size_t frame) {
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
-        poser_.SetMorphPose(i->second, motion_.GetMorphPose(i->first, frame));
+    for(size_t i=0;i<morphs_.size();++i) {
+        poser_.SetMorphPose(morphs_[i], motion_.GetMorphPose(morphs_[i], (double)frame, morph_cursors_[i]));
     }
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
-        poser_.SetBonePose(i->second, motion_.GetBonePose(i->first, frame));
+    for(size_t i=0;i<bones_.size();++i) {
+        poser_.SetBonePose(bones_[i], motion_.GetBonePose(bones_[i], (double)frame, bone_cursors_[i]));
     }
 }
 
 inline void MotionPlayer::SeekTime(double time) {
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
-        poser_.SetMorphPose(i->second, motion_.GetMorphPose(i->first, time));
+    double frame = time*30.0;
+    for(size_t i=0;i<morphs_.size();++i) {
+        poser_.SetMorphPose(morphs_[i], motion_.GetMorphPose(morphs_[i], frame, morph_cursors_[i]));
     }
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
-        poser_.SetBonePose(i->second, motion_.GetBonePose(i->first, time));
+    for(size_t i=0;i<bones_.size();++i) {
+        poser_.SetBonePose(bones_[i], motion_.GetBonePose(bones_[i], frame, bone_cursors_[i]));
     }
 }
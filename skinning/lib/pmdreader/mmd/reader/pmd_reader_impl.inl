@@ -33,8 +33,11 @@ PmdReader::ReadModel(Model &model) {
         model.SetDescription(ShiftJISToUTF16String(header.info.description));
 
         size_t vertex_num = file_.Read<std::uint32_t>();
+        ArrayView<interprete::pmd_vertex> vertices
+            = file_.ReadArray<interprete::pmd_vertex>(vertex_num);
+        model.ReserveVertices(vertex_num);
         for(size_t i=0;i<vertex_num;++i) {
-            interprete::pmd_vertex pv = file_.Read<interprete::pmd_vertex>();
+            interprete::pmd_vertex pv = vertices[i];
 
             Model::Vertex<ref> vertex = model.NewVertex();
             Model::SkinningOperator &op = vertex.GetSkinningOperator();
@@ -50,11 +53,15 @@ PmdReader::ReadModel(Model &model) {
             op.GetBDEF2().SetBoneWeight(pv.skinning_weight*0.01f);
         }
 
-        size_t triangle_num = file_.Read<std::uint32_t>()/3;
+        size_t index_num = file_.Read<std::uint32_t>();
+        size_t triangle_num = index_num/3;
+        ArrayView<std::uint16_t> indices
+            = file_.ReadArray<std::uint16_t>(index_num);
+        model.ReserveTriangles(triangle_num);
         for(size_t i=0;i<triangle_num;++i) {
             Vector3D<std::uint32_t> &triangle = model.NewTriangle();
             for(size_t j=0;j<3;++j) {
-                triangle.v[j] = file_.Read<std::uint16_t>();
+                triangle.v[j] = indices[3*i+j];
             }
         }
 
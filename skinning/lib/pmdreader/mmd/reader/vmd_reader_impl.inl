@@ -20,11 +20,14 @@ inline void VmdReader::ReadMotion(Motion &motion) {
         motion.Clear();
 
         motion.SetName(ShiftJISToUTF16String(header.name));
+        interpolator_table &curves = motion.GetCurves();
 
         size_t bone_motion_num = file_.Read<std::uint32_t>();
+        ArrayView<interprete::vmd_bone> bones
+            = file_.ReadArray<interprete::vmd_bone>(bone_motion_num);
 
         for(size_t i=0;i<bone_motion_num;++i) {
-            interprete::vmd_bone b = file_.Read<interprete::vmd_bone>();
+            interprete::vmd_bone b = bones[i];
             Motion::BoneKeyframe &keyframe = motion.GetBoneKeyframe(ShiftJISToUTF16String(b.bone_name), b.nframe);
             keyframe.SetTranslation(b.translation);
             keyframe.SetRotation(b.rotation);
@@ -36,35 +39,33 @@ inline void VmdReader::ReadMotion(Motion &motion) {
             c_0.p.y = b.x_interpolator[4]*r;
             c_1.p.x = b.x_interpolator[8]*r;
             c_1.p.y = b.x_interpolator[12]*r;
-            interpolator &x_interpolator = keyframe.GetXInterpolator();
-            x_interpolator.SetC(c_0, c_1);
+            keyframe.SetXCurve(curves.Intern(c_0, c_1));
 
             c_0.p.x = b.y_interpolator[0]*r;
             c_0.p.y = b.y_interpolator[4]*r;
             c_1.p.x = b.y_interpolator[8]*r;
             c_1.p.y = b.y_interpolator[12]*r;
-            interpolator &y_interpolator = keyframe.GetYInterpolator();
-            y_interpolator.SetC(c_0, c_1);
+            keyframe.SetYCurve(curves.Intern(c_0, c_1));
 
             c_0.p.x = b.z_interpolator[0]*r;
             c_0.p.y = b.z_interpolator[4]*r;
             c_1.p.x = b.z_interpolator[8]*r;
             c_1.p.y = b.z_interpolator[12]*r;
-            interpolator &z_interpolator = keyframe.GetZInterpolator();
-            z_interpolator.SetC(c_0, c_1);
+            keyframe.SetZCurve(curves.Intern(c_0, c_1));
 
             c_0.p.x = b.r_interpolator[0]*r;
             c_0.p.y = b.r_interpolator[4]*r;
             c_1.p.x = b.r_interpolator[8]*r;
             c_1.p.y = b.r_interpolator[12]*r;
-            interpolator &r_interpolator = keyframe.GetRInterpolator();
-            r_interpolator.SetC(c_0, c_1);
+            keyframe.SetRCurve(curves.Intern(c_0, c_1));
         }
 
         size_t morph_motion_num = file_.Read<std::uint32_t>();
-        
+        ArrayView<interprete::vmd_morph> morphs
+            = file_.ReadArray<interprete::vmd_morph>(morph_motion_num);
+
         for(size_t i=0;i<morph_motion_num;++i) {
-            interprete::vmd_morph m = file_.Read<interprete::vmd_morph>();
+            interprete::vmd_morph m = morphs[i];
             Motion::MorphKeyframe &keyframe = motion.GetMorphKeyframe(ShiftJISToUTF16String(m.morph_name), m.nframe);
             keyframe.SetWeight(m.weight);
         }
@@ -68,6 +68,27 @@ namespace mmd {
     };
 #include "unpack.inc"
 
+    /*
+     * count records of T in place in a FileReader. Records in a file have
+     * no alignment, so they are copied out one at a time.
+     */
+    template<typename T>
+    class ArrayView
+    {
+    public:
+        ArrayView(const std::uint8_t *data, size_t count);
+        size_t GetSize() const;
+        T operator[](size_t index) const;
+    private:
+        const std::uint8_t *data_;
+        size_t count_;
+    };
+
+    /*
+     * The file is mapped read-only where mmap is available and read into
+     * a buffer otherwise. Reads are bounds-checked and copy out of the
+     * file, so they do not depend on its alignment.
+     */
     class FileReader
     {
     public:
@@ -75,16 +96,17 @@ namespace mmd {
 
         FileReader(const std::string &filename);
         FileReader(const std::wstring &filename);
+        ~FileReader();
 
         static bool FileExists(const std::wstring &filename);
 
         template<typename T> T Read();
+        template<typename T> ArrayView<T> ReadArray(size_t count);
         size_t ReadIndex(size_t byte_size);
         std::string ReadAnsiString();
         std::wstring ReadString(bool utf8 = false);
 
-        buffer_type& GetBuffer();
-        const buffer_type& GetBuffer() const;
+        const std::uint8_t *GetData() const;
         void Reset();
 
         const std::wstring& GetPath() const;
@@ -97,8 +119,15 @@ namespace mmd {
         size_t GetPosition() const;
         ptrdiff_t GetRemainedLength() const;
     private:
+        FileReader(const FileReader&);
+        FileReader &operator=(const FileReader&);
+
         void Initialize();
+        const std::uint8_t *Take(size_t length);
         std::wstring path_;
+        const std::uint8_t *data_;
+        size_t length_;
+        void *mapping_;
         buffer_type buffer_;
         size_t cursor_;
     };
@@ -29,38 +29,74 @@ template<size_t length> inline mmd_string<length>::operator std::string () const
 }
 
 inline void FileReader::Initialize() {
-#ifdef MMD_WINDOWS
-    FILE *f = _wfopen(path_.c_str(), L"rb");
+#ifndef MMD_WINDOWS
+    int fd = open(UTF16ToNativeString(path_).c_str(), O_RDONLY);
+    if(fd<0) {
+        throw exception(std::string("FileReader: Cannot open file."));
+    }
+    struct stat st;
+    if(fstat(fd, &st)!=0 || st.st_size==0) {
+        close(fd);
+        throw exception(std::string("FileReader: File is empty."));
+    }
+    length_ = (size_t)st.st_size;
+    void *mapping = mmap(NULL, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping!=MAP_FAILED) {
+        close(fd);
+        mapping_ = mapping;
+        data_ = static_cast<const std::uint8_t*>(mapping);
+        return;
+    }
+    buffer_.assign(length_, 0);
+    size_t done = 0;
+    while(done<length_) {
+        ssize_t n = read(fd, &buffer_[done], length_-done);
+        if(n<=0) {
+            close(fd);
+            throw exception(std::string("FileReader: Cannot read file."));
+        }
+        done += (size_t)n;
+    }
+    close(fd);
 #else
-    FILE *f = fopen(UTF16ToNativeString(path_).c_str(), "rb");
-#endif
+    FILE *f = _wfopen(path_.c_str(), L"rb");
     if(f==NULL) {
         throw exception(std::string("FileReader: Cannot open file."));
     }
     fseek(f, 0, SEEK_END);
-    size_t file_length = (size_t)ftell(f);
-    if(file_length==0) {
+    length_ = (size_t)ftell(f);
+    if(length_==0) {
         fclose(f);
         throw exception(std::string("FileReader: File is empty."));
     }
     fseek(f, 0, SEEK_SET);
-    buffer_.assign(file_length, 0);
-    fread(&buffer_[0], 1, file_length, f);
+    buffer_.assign(length_, 0);
+    fread(&buffer_[0], 1, length_, f);
     fclose(f);
+#endif
+    data_ = &buffer_[0];
 }
 
-inline FileReader::FileReader() : cursor_(0) {}
+inline FileReader::FileReader() : data_(NULL), length_(0), mapping_(NULL), cursor_(0) {}
 
-inline FileReader::FileReader(const std::string &filename) : path_(NativeToUTF16String(filename)), cursor_(0)
+inline FileReader::FileReader(const std::string &filename) : path_(NativeToUTF16String(filename)), data_(NULL), length_(0), mapping_(NULL), cursor_(0)
 {
     Initialize();
 }
 
-inline FileReader::FileReader(const std::wstring &filename) : path_(filename), cursor_(0)
+inline FileReader::FileReader(const std::wstring &filename) : path_(filename), data_(NULL), length_(0), mapping_(NULL), cursor_(0)
 {
     Initialize();
 }
 
+inline FileReader::~FileReader() {
+#ifndef MMD_WINDOWS
+    if(mapping_!=NULL) {
+        munmap(mapping_, length_);
+    }
+#endif
+}
+
 inline bool FileReader::FileExists(const std::wstring &filename) {
 #ifdef MMD_WINDOWS
     FILE *f = _wfopen(filename.c_str(), L"rb");
@@ -74,65 +110,69 @@ inline bool FileReader::FileExists(const std::wstring &filename) {
     return result;
 }
 
-template<typename T> inline T FileReader::Read() {
-    if(cursor_+sizeof(T)>buffer_.size()) {
+inline const std::uint8_t *FileReader::Take(size_t length) {
+    if(length>length_-cursor_) {
         throw exception(std::string("FileReader: Buffer length exceeded"));
     }
-    T t = *reinterpret_cast<T*>(&buffer_[cursor_]);
-    cursor_ += sizeof(T);
+    const std::uint8_t *p = data_+cursor_;
+    cursor_ += length;
+    return p;
+}
+
+template<typename T> inline T FileReader::Read() {
+    T t;
+    memcpy(&t, Take(sizeof(T)), sizeof(T));
     return t;
 }
 
-inline size_t FileReader::ReadIndex(size_t byte_size) {
-    if(cursor_+byte_size>buffer_.size()) {
+template<typename T> inline ArrayView<T> FileReader::ReadArray(size_t count) {
+    if(count>(length_-cursor_)/sizeof(T)) {
         throw exception(std::string("FileReader: Buffer length exceeded"));
     }
-    size_t result;
+    return ArrayView<T>(Take(count*sizeof(T)), count);
+}
+
+inline size_t FileReader::ReadIndex(size_t byte_size) {
     switch(byte_size) {
     case 1:
-        result = (size_t)(*reinterpret_cast<std::uint8_t*>(&buffer_[cursor_]));
-        break;
+        return (size_t)Read<std::uint8_t>();
     case 2:
-        result = (size_t)(*reinterpret_cast<std::uint16_t*>(&buffer_[cursor_]));
-        break;
+        return (size_t)Read<std::uint16_t>();
     case 4:
-        result = (size_t)(*reinterpret_cast<std::int32_t*>(&buffer_[cursor_]));
-        break;
+        return (size_t)Read<std::int32_t>();
     default:
         throw exception(std::string("FileReader: Invalid byte size"));
     }
-    cursor_ += byte_size;
-    return result;
 }
 
 inline std::string FileReader::ReadAnsiString() {
     size_t length = (size_t)Read<std::int32_t>();
-    if(cursor_+length>buffer_.size()) {
-        throw exception(std::string("FileReader: Buffer length exceeded"));
-    }
-    cursor_ += length;
-    return std::string((char*)&buffer_[cursor_-length], length);
+    return std::string((const char*)Take(length), length);
 }
 
 inline std::wstring FileReader::ReadString(bool utf8) {
     size_t length = (size_t)Read<std::int32_t>();
-    if(cursor_+length>buffer_.size()) {
-        throw exception(std::string("FileReader: Buffer length exceeded"));
-    }
-    cursor_ += length;
+    const std::uint8_t *p = Take(length);
     if(!utf8) {
 #ifdef MMD_WINDOWS
-        return std::wstring((wchar_t*)&buffer_[cursor_-length], length/sizeof(wchar_t));
+        std::wstring ws(length/sizeof(wchar_t), 0);
+        memcpy(&ws[0], p, ws.size()*sizeof(wchar_t));
+        return ws;
 #else
-        return std::wstring((std::uint16_t*)&buffer_[cursor_-length], (std::uint16_t*)&buffer_[cursor_]);
+        std::wstring ws(length/sizeof(std::uint16_t), 0);
+        for(size_t i=0;i<ws.size();++i) {
+            std::uint16_t c;
+            memcpy(&c, p+i*sizeof(c), sizeof(c));
+            ws[i] = c;
+        }
+        return ws;
 #endif
     } else {
-        return UTF8ToUTF16String(std::string((char*)&buffer_[cursor_-length], length));
+        return UTF8ToUTF16String(std::string((const char*)p, length));
     }
 }
 
-inline buffer_type& FileReader::GetBuffer() { return buffer_; }
-inline const buffer_type& FileReader::GetBuffer() const { return buffer_; }
+inline const std::uint8_t *FileReader::GetData() const { return data_; }
 inline void FileReader::Reset() { cursor_ = 0; }
 
 inline const std::wstring& FileReader::GetPath() const {
@@ -156,13 +196,13 @@ inline std::wstring FileReader::GetLocation() const {
 }
 
 inline void FileReader::Seek(size_t position) {
-    if(position<=buffer_.size()) {
+    if(position<=length_) {
         cursor_ = position;
     }
 }
 
 inline size_t FileReader::GetLength() const {
-    return buffer_.size();
+    return length_;
 }
 
 inline size_t FileReader::GetPosition() const {
@@ -170,7 +210,19 @@ inline size_t FileReader::GetPosition() const {
 }
 
 inline ptrdiff_t FileReader::GetRemainedLength() const {
-    return buffer_.size()-cursor_;
+    return length_-cursor_;
+}
+
+template<typename T> inline ArrayView<T>::ArrayView(const std::uint8_t *data, size_t count) : data_(data), count_(count) {}
+
+template<typename T> inline size_t ArrayView<T>::GetSize() const {
+    return count_;
+}
+
+template<typename T> inline T ArrayView<T>::operator[](size_t index) const {
+    T t;
+    memcpy(&t, data_+index*sizeof(T), sizeof(T));
+    return t;
 }
 
 
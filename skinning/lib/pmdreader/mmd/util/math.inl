@@ -460,6 +460,31 @@ namespace mmd {
         Vector2D<T> c_0, c_1;
     };
 
+    /*
+     * Distinct Bezier curves, presampled like Bezier::operator[] into one
+     * shared array. Curves are interned by their control points and
+     * referred to by a small index; curve 0 is the linear one. The linear
+     * curve is presampled like any other, so a lookup is the same
+     * branchless blend of two neighbouring samples for every curve.
+     */
+    template <typename T, size_t presample_resolution = 32> class BezierTable {
+    public:
+        typedef std::uint16_t index_type;
+
+        BezierTable();
+
+        index_type Intern(const Vector2D<T>& c_0, const Vector2D<T>& c_1);
+        size_t GetSize() const;
+        const Vector2D<T>& GetC(index_type curve, size_t i) const;
+
+        T operator()(index_type curve, T x) const;
+        void Evaluate(const index_type *curves, const T *x, T *y, size_t n) const;
+    private:
+        std::vector<T> presamples_;
+        std::vector<Vector2D<T>> controls_;
+        std::map<std::pair<std::pair<T, T>, std::pair<T, T>>, index_type> indices_;
+    };
+
 #include "math_impl.inl"
 } /* End of namespace mmd */
 #endif /* __MATH_HXX_96FA1D6C8B55A3C9CFFA645F66F5B21F_INCLUDED__ */
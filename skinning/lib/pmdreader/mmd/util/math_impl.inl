@@ -1413,7 +1413,7 @@ template <typename T, size_t presample_resolution> inline T Bezier<T, presample_
         lm = (l+r)*T(0.5);
         rm = T(1)-lm;
         m = lm*(rm*(rm*c_0.p.x+lm*c_1.p.x)+lm*lm);
-        if(abs(m-x)<T(mmd_math_const_eps)) {
+        if(std::abs(m-x)<T(mmd_math_const_eps)) {
             break;
         }
         if(m>x) {
@@ -1425,3 +1425,57 @@ template <typename T, size_t presample_resolution> inline T Bezier<T, presample_
     rm = T(1)-lm;
     return lm*(rm*(rm*c_0.p.y+lm*c_1.p.y)+lm*lm);
 }
+template <typename T, size_t presample_resolution> inline BezierTable<T, presample_resolution>::BezierTable() {
+    Vector2D<T> c_0, c_1;
+    c_0.p.x = c_0.p.y = T(0);
+    c_1.p.x = c_1.p.y = T(1);
+    Intern(c_0, c_1);
+}
+template <typename T, size_t presample_resolution> inline typename BezierTable<T, presample_resolution>::index_type BezierTable<T, presample_resolution>::Intern(const Vector2D<T>& c_0, const Vector2D<T>& c_1) {
+    // Every linear curve is curve 0.
+    bool linear = (c_0.p.x==c_0.p.y)&&(c_1.p.x==c_1.p.y);
+    std::pair<std::pair<T, T>, std::pair<T, T>> key;
+    if(linear) {
+        key = std::make_pair(std::make_pair(T(0), T(0)), std::make_pair(T(1), T(1)));
+    } else {
+        key = std::make_pair(std::make_pair(c_0.p.x, c_0.p.y), std::make_pair(c_1.p.x, c_1.p.y));
+    }
+    typename std::map<std::pair<std::pair<T, T>, std::pair<T, T>>, index_type>::const_iterator i = indices_.find(key);
+    if(i!=indices_.end()) {
+        return i->second;
+    }
+    if(controls_.size()/2>index_type(-1)) {
+        throw exception(std::string("BezierTable::Intern: Too many distinct curves."));
+    }
+    index_type index = index_type(controls_.size()/2);
+    Bezier<T, presample_resolution> curve(c_0, c_1);
+    controls_.push_back(c_0);
+    controls_.push_back(c_1);
+    for(size_t j = 0;j<presample_resolution;++j) {
+        T x = j/T(presample_resolution-1);
+        presamples_.push_back(curve(x));
+    }
+    indices_.insert(std::make_pair(key, index));
+    return index;
+}
+template <typename T, size_t presample_resolution> inline size_t BezierTable<T, presample_resolution>::GetSize() const {
+    return controls_.size()/2;
+}
+template <typename T, size_t presample_resolution> inline const Vector2D<T>& BezierTable<T, presample_resolution>::GetC(index_type curve, size_t i) const {
+    return controls_[2*curve+i];
+}
+template <typename T, size_t presample_resolution> inline T BezierTable<T, presample_resolution>::operator()(index_type curve, T x) const {
+    T y;
+    Evaluate(&curve, &x, &y, 1);
+    return y;
+}
+template <typename T, size_t presample_resolution> inline void BezierTable<T, presample_resolution>::Evaluate(const index_type *curves, const T *x, T *y, size_t n) const {
+    const T *presamples = &presamples_[0];
+    for(size_t i = 0;i<n;++i) {
+        T s = std::min(std::max(x[i], T(0)), T(1))*T(presample_resolution-1);
+        size_t ix = std::min(size_t(s), presample_resolution-2);
+        T r = s-T(ix);
+        const T *p = presamples+curves[i]*presample_resolution+ix;
+        y[i] = (T(1)-r)*p[0]+r*p[1];
+    }
+}
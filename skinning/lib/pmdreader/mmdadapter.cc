@@ -9,6 +9,7 @@
 
 #include "mmdadapter.h"
 #include "mmd/mmdslim.hh"
+#include "mmd/reader/interprete/vmd_types.inl"
 #include "bitmap.h"
 
 using std::endl;
@@ -47,6 +48,48 @@ namespace {
 		lhs[2] = rhs.v[2];
 		return lhs;
 	}
+
+	/*
+	 * One VMD bone keyframe. Each curve is x1, y1, x2, y2 of a cubic
+	 * Bezier from (0, 0) to (127, 127), for the three translation axes
+	 * and the rotation in that order, and eases the segment that ends at
+	 * this keyframe.
+	 */
+	struct VmdKey {
+		size_t frame;
+		glm::vec3 trans;
+		glm::fquat rot;
+		std::int8_t curve[4][4];
+	};
+
+	const char* kVmdMagic = "Vocaloid Motion Data 0002";
+	const size_t kMaxMotionFrames = 30 * 60 * 60; // An hour
+
+	float evaluateCurve(const std::int8_t* c, float x)
+	{
+		if (c[0] == c[1] && c[2] == c[3])
+			return x;
+		const float r = 3.0f / 127.0f;
+		float x1 = c[0] * r, y1 = c[1] * r, x2 = c[2] * r, y2 = c[3] * r;
+		// x(t) is monotonic. Newton's method converges in a few steps;
+		// where it would leave the bracket around the root, bisect.
+		float lo = 0.0f, hi = 1.0f, t = x;
+		for (int i = 0; i < 16; i++) {
+			float s = 1.0f - t;
+			float dx = t * (s * (s * x1 + t * x2) + t * t) - x;
+			if (std::abs(dx) < 1e-6f)
+				break;
+			if (dx > 0.0f)
+				hi = t;
+			else
+				lo = t;
+			float slope = x1 * s * (s - 2.0f * t) + x2 * t * (2.0f * s - t) + 3.0f * t * t;
+			float next = slope > 0.0f ? t - dx / slope : lo;
+			t = next > lo && next < hi ? next : 0.5f * (lo + hi);
+		}
+		float s = 1.0f - t;
+		return t * (s * (s * y1 + t * y2) + t * t);
+	}
 };
 
 class MMDAdapter {
@@ -61,6 +104,16 @@ class MMDAdapter {
 		} while (true);
 		return bone_id == 0;
 	}
+
+	/*
+	 * Read-only, unlike operator[], so joints and weights can be read
+	 * concurrently. -1 for bones that are not joints.
+	 */
+	int usefulBone(size_t pmd_bone) const
+	{
+		auto iter = pmd_bone_to_useful_bone_.find(int(pmd_bone));
+		return iter == pmd_bone_to_useful_bone_.end() ? -1 : iter->second;
+	}
 public:
 	MMDAdapter()
 	{
@@ -124,10 +177,12 @@ public:
 		}
 	}
 
-	void getMaterial(std::vector<Material>& vm)
+	void getMaterial(std::vector<Material>& vm, std::vector<std::string>* texture_files)
 	{
 		std::map<std::string, std::shared_ptr<Image>> loaded_tex;
 		vm.resize(model_.GetPartNum());
+		if (texture_files)
+			texture_files->assign(vm.size(), std::string());
 		for (size_t i = 0; i < vm.size(); i++) {
 			const auto& part = model_.GetPart(i);
 			const auto& material = part.GetMaterial();
@@ -143,24 +198,18 @@ public:
 			std::string texfn = mmd::UTF16ToNativeString(tex->GetTexturePath());
 			if (texfn.empty())
 				continue;
+			if (texture_files) {
+				(*texture_files)[i] = texfn;
+				continue;
+			}
 			auto iter = loaded_tex.find(texfn);
 			if (iter != loaded_tex.end()) {
 				vm[i].texture = iter->second;
 				continue;
 			}
-			auto image = std::make_shared<Image>();
-			std::cerr << __func__ << " is trying to load texture " << texfn << std::endl;
-			if (!readBMP(texfn.data(), *image))
+			auto image = MMDReader::loadTexture(texfn);
+			if (!image)
 				continue;
-			std::cerr << __func__ << " successfully loaded texture " << texfn << std::endl;
-#if 0
-			std::cerr << "\t\ttesting RGB ";
-			for (int i = 0; i < 64; i++)
-				std::cerr << int(image->bytes[i]) << ' ';
-			std::cerr << std::endl;
-			//std::cerr << "\t\ttesting RGB " << int(image->bytes[0]) << ' ' << int(image->bytes[1]) << ' ' << int(image->bytes[2]) << ' ' << std::endl;
-			//std::cerr << "\t\ttesting RGB " << int(image->bytes[256]) << ' ' << int(image->bytes[257]) << ' ' << int(image->bytes[258]) << ' ' << std::endl;
-#endif
 			loaded_tex[texfn] = image;
 			vm[i].texture = image;
 		}
@@ -170,7 +219,7 @@ public:
 	{
 		if (useful_bone_id >= int(useful_bone_to_pmd_bone_.size()) || useful_bone_id < 0)
 			return false;
-		int id = useful_bone_to_pmd_bone_[useful_bone_id];		
+		int id = useful_bone_to_pmd_bone_.at(useful_bone_id);
 		const auto& bone = model_.GetBone(id);
 		size_t mmd_parent = bone.GetParentIndex();
 		size_t mmd_child = bone.GetChildIndex();
@@ -179,7 +228,7 @@ public:
 			parent = -1;
 			wcoord = glm::vec3(conv(child_bone.GetPosition()));
 		} else {
-			parent = pmd_bone_to_useful_bone_[int(mmd_parent)];
+			parent = usefulBone(mmd_parent);
 			wcoord = glm::vec3(conv(child_bone.GetPosition()));
 		}
 #if 0
@@ -217,7 +266,7 @@ public:
 				case SKINNING_BDEF1:
 					{
 						const auto& bdef1 = v.GetSkinningOperator().GetBDEF1();
-						auto bid = pmd_bone_to_useful_bone_[bdef1.GetBoneID()];
+						auto bid = usefulBone(bdef1.GetBoneID());
 						if (bid >= 0)
 							tup.emplace_back(i, bid, -1, 1.0f);
 					}
@@ -225,8 +274,8 @@ public:
 				case SKINNING_BDEF2:
 					{
 						const auto& bdef2 = v.GetSkinningOperator().GetBDEF2();
-						auto bid0 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(0)];
-						auto bid1 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(1)];
+						auto bid0 = usefulBone(bdef2.GetBoneID(0));
+						auto bid1 = usefulBone(bdef2.GetBoneID(1));
 						if (bid0 >= 0 && bid1 >= 0) {
 							tup.emplace_back(i, bid0, bid1, bdef2.GetBoneWeight());
 						}
@@ -240,7 +289,7 @@ public:
 #if 0
 						const auto& bdef4 = v.GetSkinningOperator().GetBDEF4();
 						for (int i = 0 ; i < 4; i++) {
-							auto bid = pmd_bone_to_useful_bone_[bdef4.GetBoneID(i)];
+							auto bid = usefulBone(bdef4.GetBoneID(i));
 							if (bid < 0)
 								continue;
 							tup.emplace_back(bid, i, bdef4.GetBoneWeight(i));
@@ -256,6 +305,143 @@ public:
 			//std::cerr << bdef2.GetBoneID(0) << "\t" << bdef2.GetBoneID(1) << "\t" << bdef2.GetBoneWeight() << endl;
 		}
 	}
+	void getJointNames(std::vector<std::wstring>& names)
+	{
+		names.resize(useful_bone_to_pmd_bone_.size());
+		for (const auto& bone : useful_bone_to_pmd_bone_)
+			names[bone.first] = model_.GetBone(bone.second).GetName();
+	}
+
+	/*
+	 * Needs no opened model, joint_by_name binds bones to joints.
+	 */
+	static bool getMotion(const std::string& fn,
+			      const std::unordered_map<std::wstring, int>& joint_by_name,
+			      size_t njoints,
+			      std::vector<glm::fquat>& rel_rot,
+			      std::vector<glm::vec3>& root_trans,
+			      int& nframes)
+	{
+		std::vector<std::vector<VmdKey>> tracks(njoints);
+		try {
+			mmd::FileReader file(fn);
+			auto header = file.Read<mmd::interprete::vmd_header>();
+			if (std::string(header.magic) != kVmdMagic) {
+				std::cerr << fn << " is not a VMD file" << endl;
+				return false;
+			}
+			size_t nkeys = file.Read<std::uint32_t>();
+			if (nkeys > file.GetRemainedLength() / sizeof(mmd::interprete::vmd_bone)) {
+				std::cerr << fn << " is truncated" << endl;
+				return false;
+			}
+			auto records = file.ReadArray<mmd::interprete::vmd_bone>(nkeys);
+			// Every bone name is converted and bound once, not once per
+			// keyframe; VMD names are Shift-JIS like the model's.
+			std::unordered_map<std::string, int> binding;
+			for (size_t i = 0; i < nkeys; i++) {
+				auto b = records[i];
+				std::string name = b.bone_name;
+				auto iter = binding.find(name);
+				if (iter == binding.end()) {
+					auto bone = joint_by_name.find(mmd::ShiftJISToUTF16String(name));
+					int joint = bone != joint_by_name.end() ? bone->second : -1;
+					iter = binding.emplace(name, joint).first;
+				}
+				if (iter->second < 0)
+					continue;
+				VmdKey key;
+				key.frame = b.nframe;
+				key.trans = glm::vec3(b.translation.v[0], b.translation.v[1], b.translation.v[2]);
+				key.rot = glm::normalize(glm::fquat(b.rotation.v[3], b.rotation.v[0], b.rotation.v[1], b.rotation.v[2]));
+				const std::int8_t* curves[4] = { b.x_interpolator, b.y_interpolator, b.z_interpolator, b.r_interpolator };
+				for (int c = 0; c < 4; c++)
+					for (int k = 0; k < 4; k++)
+						key.curve[c][k] = curves[c][4 * k];
+				tracks[iter->second].push_back(key);
+			}
+			size_t unbound = 0;
+			for (const auto& bound : binding)
+				if (bound.second < 0)
+					unbound++;
+			if (unbound > 0)
+				std::cerr << unbound << " of " << binding.size() << " bones in " << fn << " are not in the model" << endl;
+		} catch (std::exception& e) {
+			std::cerr << e.what() << endl;
+			return false;
+		}
+
+		size_t last_frame = 0;
+		size_t nmoved = 0;
+		bool any = false;
+		for (size_t j = 0; j < njoints; j++) {
+			auto& track = tracks[j];
+			if (track.empty())
+				continue;
+			std::stable_sort(track.begin(), track.end(),
+					[](const VmdKey& a, const VmdKey& b) { return a.frame < b.frame; });
+			// A later record for the same frame replaces an earlier one.
+			size_t n = 0;
+			for (size_t i = 0; i < track.size(); i++) {
+				if (n > 0 && track[n - 1].frame == track[i].frame)
+					track[n - 1] = track[i];
+				else
+					track[n++] = track[i];
+			}
+			track.resize(n);
+			last_frame = std::max(last_frame, track.back().frame);
+			any = true;
+			if (j > 0)
+				for (const auto& key : track)
+					if (key.trans != glm::vec3(0.0f)) {
+						nmoved++;
+						break;
+					}
+		}
+		if (!any) {
+			std::cerr << "No bone in " << fn << " is in the model" << endl;
+			return false;
+		}
+		if (last_frame >= kMaxMotionFrames) {
+			std::cerr << fn << " is too long: " << last_frame << " frames" << endl;
+			return false;
+		}
+		if (nmoved > 0)
+			std::cerr << nmoved << " bones in " << fn << " move; only Joint 0 keeps its translation" << endl;
+
+		nframes = int(last_frame + 1);
+		rel_rot.assign(size_t(nframes) * njoints, glm::fquat(1.0f, 0.0f, 0.0f, 0.0f));
+		root_trans.assign(nframes, glm::vec3(0.0f));
+		#pragma omp parallel for
+		for (int j = 0; j < int(njoints); j++) {
+			const auto& track = tracks[j];
+			if (track.empty())
+				continue;
+			size_t next = 0; // First keyframe after the frame
+			for (int f = 0; f < nframes; f++) {
+				while (next < track.size() && track[next].frame <= size_t(f))
+					next++;
+				glm::vec3 trans;
+				glm::fquat rot;
+				if (next == 0 || next == track.size()) {
+					const VmdKey& key = track[next == 0 ? 0 : next - 1];
+					trans = key.trans;
+					rot = key.rot;
+				} else {
+					const VmdKey& a = track[next - 1];
+					const VmdKey& b = track[next];
+					float x = float(f - a.frame) / float(b.frame - a.frame);
+					for (int k = 0; k < 3; k++)
+						trans[k] = glm::mix(a.trans[k], b.trans[k], evaluateCurve(b.curve[k], x));
+					rot = glm::slerp(a.rot, b.rot, evaluateCurve(b.curve[3], x));
+				}
+				rel_rot[size_t(f) * njoints + j] = rot;
+				if (j == 0)
+					root_trans[f] = trans;
+			}
+		}
+		return true;
+	}
 private:
 	mmd::Model model_;
 	std::unordered_map<int, int> useful_bone_to_pmd_bone_, pmd_bone_to_useful_bone_;
@@ -283,9 +469,19 @@ void MMDReader::getMesh(std::vector<glm::vec4>& V,
 	d_->getMesh(V, F, N, UV);
 }
 
-void MMDReader::getMaterial(std::vector<Material>& vm)
+void MMDReader::getMaterial(std::vector<Material>& vm, std::vector<std::string>* texture_files)
+{
+	d_->getMaterial(vm, texture_files);
+}
+
+std::shared_ptr<Image> MMDReader::loadTexture(const std::string& fn)
 {
-	d_->getMaterial(vm);
+	auto image = std::make_shared<Image>();
+	std::cerr << __func__ << " is trying to load texture " << fn << std::endl;
+	if (!readBMP(fn.data(), *image))
+		return nullptr;
+	std::cerr << __func__ << " successfully loaded texture " << fn << std::endl;
+	return image;
 }
 
 bool MMDReader::getJoint(int id, glm::vec3& wcoord, int& parent)
@@ -297,3 +493,21 @@ void MMDReader::getJointWeights(std::vector<SparseTuple>& tup)
 {
 	d_->getJointWeights(tup);
 }
+
+void MMDReader::getJointNames(std::vector<std::wstring>& names)
+{
+	d_->getJointNames(names);
+}
+
+bool MMDReader::getMotion(const std::string& fn,
+		const std::vector<std::wstring>& joint_names,
+		std::vector<glm::fquat>& rel_rot,
+		std::vector<glm::vec3>& root_trans,
+		int& nframes)
+{
+	// Of joints sharing a name, the last one gets its bone.
+	std::unordered_map<std::wstring, int> joint_by_name;
+	for (size_t j = 0; j < joint_names.size(); j++)
+		joint_by_name[joint_names[j]] = int(j);
+	return MMDAdapter::getMotion(fn, joint_by_name, joint_names.size(), rel_rot, root_trans, nframes);
+}
@@ -9,6 +9,7 @@
 #include "material.h"
 #include <image.h>
 #include <string>
+#include <glm/gtc/quaternion.hpp>
 
 class MMDAdapter;
 
@@ -52,8 +53,22 @@ public:
 	/*
 	 * Get list of materials
 	 * Check Material struct (in material.h) for details
+	 * Output:
+	 *      texture_files: if given, the texture file of each material,
+	 *                     empty if it has none. The textures are then
+	 *                     left to the caller, e.g. to load them
+	 *                     concurrently with loadTexture; otherwise they
+	 *                     are loaded here, one after another.
+	 */
+	void getMaterial(std::vector<Material>&,
+			 std::vector<std::string>* texture_files = nullptr);
+	/*
+	 * Load a texture file as tightly packed RGBA rows (see Image).
+	 * Safe to call from several threads at once.
+	 * Return:
+	 *      the image, or null if it failed to load
 	 */
-	void getMaterial(std::vector<Material>&);
+	static std::shared_ptr<Image> loadTexture(const std::string& fn);
 	/*
 	 * Get a joint for given ID
 	 * Input:
@@ -70,6 +85,9 @@ public:
 	 *       adapter.
 	 *
 	 *       The bone structure in actual PMD files is a forest.
+	 *
+	 *       getMesh, getJoint, getJointNames and getJointWeights only read
+	 *       the opened model, so they may run concurrently.
 	 */
 	bool getJoint(int id, glm::vec3& wcoord, int& parent);
 	/*
@@ -84,6 +102,39 @@ public:
 	 *       reading another weight from VRAM.
 	 */
 	void getJointWeights(std::vector<SparseTuple>& tup);
+	/*
+	 * Get the name of every joint, by joint ID, for getMotion.
+	 * Output:
+	 *      names: one name per joint
+	 */
+	void getJointNames(std::vector<std::wstring>& names);
+	/*
+	 * Read a VMD motion for a model, sampled at every VMD frame (30
+	 * frames per second) from frame 0 to its last keyframe. No model
+	 * has to be opened, so a model loaded from elsewhere can keep the
+	 * names of its joints instead.
+	 * Input:
+	 *      fn: VMD file name
+	 *      joint_names: the names of the joints, see getJointNames
+	 * Output:
+	 *      rel_rot: nframes * (number of joints) rotations, relative to
+	 *               the rest pose, frame after frame
+	 *      root_trans: nframes translations of Joint 0
+	 *      nframes: the number of frames
+	 * Return:
+	 *      true: the motion was read and some bone of it is a joint
+	 *      false: otherwise
+	 *
+	 * Note: VMD bones are bound to joints by their names. Bones the model
+	 *       does not have as joints are skipped, and so is the translation
+	 *       of any joint other than Joint 0. IK is not solved. Between
+	 *       keyframes the Bezier curves of the VMD are evaluated.
+	 */
+	static bool getMotion(const std::string& fn,
+			      const std::vector<std::wstring>& joint_names,
+			      std::vector<glm::fquat>& rel_rot,
+			      std::vector<glm::vec3>& root_trans,
+			      int& nframes);
 private:
 	std::unique_ptr<MMDAdapter> d_;
 };
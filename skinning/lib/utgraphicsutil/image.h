@@ -3,17 +3,31 @@
 
 #include <vector>
 
+enum ImageEncoding {
+	kImagePixels, // Pixels as described at Image::bytes
+	kImageBC1,    // 4x4 blocks of 8 bytes, opaque (DXT1)
+	kImageBC3     // 4x4 blocks of 16 bytes, with alpha (DXT5)
+};
+
 struct Image {
 	/*
- 	 * Image data in GL_RGB sequence.
-	 * Notes: because of some funny alignment problem it's recommended to
-	 * transform the data into GL_RGBA format before calling
-	 * glTexSubImage2D if you want to use the data for texture mapping
+ 	 * Image data in GL_RGB sequence, as the JPEG routines use it.
+	 * Textures from readBMP and MMDReader::loadTexture are in GL_RGBA
+	 * sequence with tightly packed rows (stride == 4 * width) instead, so
+	 * they can be passed to glTexSubImage2D as they are.
 	 */
 	std::vector<unsigned char> bytes;
 	int width;
 	int height;
-	int stride; // Stores the actual number of bytes for a scan line, you can ignore this for our current case.
+	int stride; // Stores the actual number of bytes for a scan line
+	/*
+	 * Textures may carry a mip chain: levels - 1 smaller images follow
+	 * the first one in bytes, each half the size of the one before.
+	 * Block compressed images have no scan lines; stride is then the
+	 * number of bytes for a row of blocks.
+	 */
+	int levels = 1;
+	ImageEncoding encoding = kImagePixels;
 };
 
 #endif
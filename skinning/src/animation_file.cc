@@ -0,0 +1,185 @@
+#include "animation_file.h"
+#include "timeline.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static_assert(sizeof(glm::fquat) == 4 * sizeof(float), "quaternions are stored as 4 floats");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "vectors are stored as 3 floats");
+
+namespace {
+	const char kMagic[4] = { 'V', 'M', 'A', 'N' };
+	const uint32_t kVersion = 1;
+
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + kAnimationFileAlignment - 1) / kAnimationFileAlignment * kAnimationFileAlignment;
+	}
+
+	/*
+	 * Where every block goes for a given size.
+	 */
+	void layout(AnimationFileHeader& header, int njoints, int nkeys)
+	{
+		std::memcpy(header.magic, kMagic, sizeof(kMagic));
+		header.version = kVersion;
+		header.njoints = njoints;
+		header.nkeys = nkeys;
+		header.time_offset = alignUp(sizeof(AnimationFileHeader));
+		header.rel_rot_offset = alignUp(header.time_offset + uint64_t(nkeys) * sizeof(float));
+		header.root_trans_offset = alignUp(header.rel_rot_offset + uint64_t(nkeys) * njoints * sizeof(glm::fquat));
+		header.file_size = header.root_trans_offset + uint64_t(nkeys) * sizeof(glm::vec3);
+	}
+
+	bool endsWith(const std::string& s, const std::string& suffix)
+	{
+		return s.size() >= suffix.size() &&
+		       s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+}
+
+bool MappedAnimationFile::open(const std::string& fn)
+{
+	close();
+	if (!file_.open(fn)) {
+		std::cerr << "Cannot open " << fn << std::endl;
+		return false;
+	}
+	if (file_.size() < sizeof(AnimationFileHeader)) {
+		std::cerr << fn << " is not an animation file" << std::endl;
+		close();
+		return false;
+	}
+
+	const AnimationFileHeader* header = reinterpret_cast<const AnimationFileHeader*>(file_.data());
+	AnimationFileHeader expected;
+	bool valid = std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+	             header->version == kVersion && header->njoints > 0 && header->nkeys >= 0;
+	if (valid) {
+		layout(expected, header->njoints, header->nkeys);
+		valid = header->time_offset == expected.time_offset &&
+		        header->rel_rot_offset == expected.rel_rot_offset &&
+		        header->root_trans_offset == expected.root_trans_offset &&
+		        header->file_size == expected.file_size;
+	}
+	if (!valid) {
+		std::cerr << fn << " is not an animation file" << std::endl;
+		close();
+		return false;
+	}
+	if (header->file_size > file_.size()) {
+		std::cerr << fn << " is truncated" << std::endl;
+		close();
+		return false;
+	}
+	header_ = header;
+	return true;
+}
+
+void MappedAnimationFile::close()
+{
+	file_.close();
+	header_ = nullptr;
+}
+
+const float* MappedAnimationFile::time() const
+{
+	return reinterpret_cast<const float*>(file_.data() + header_->time_offset);
+}
+
+const glm::fquat* MappedAnimationFile::relRot(int index) const
+{
+	return reinterpret_cast<const glm::fquat*>(file_.data() + header_->rel_rot_offset) +
+	       size_t(index) * header_->njoints;
+}
+
+const glm::vec3* MappedAnimationFile::rootTrans() const
+{
+	return reinterpret_cast<const glm::vec3*>(file_.data() + header_->root_trans_offset);
+}
+
+bool isBinaryAnimationFile(const std::string& fn)
+{
+	return endsWith(fn, ".vma");
+}
+
+bool isMotionFile(const std::string& fn)
+{
+	return endsWith(fn, ".vmd");
+}
+
+bool saveAnimationBinary(const std::string& fn, const TimelineKeys& keys, std::atomic<float>* progress)
+{
+	std::ofstream file(fn, std::ios::binary);
+	if (!file) {
+		std::cerr << "Cannot write animation " << fn << std::endl;
+		return false;
+	}
+	int njoints = keys.getNumberOfJoints();
+	int nkeys = keys.size();
+	AnimationFileHeader header;
+	layout(header, njoints, nkeys);
+
+	const char padding[kAnimationFileAlignment] = {};
+	auto pad = [&file, &padding](uint64_t offset) {
+		file.write(padding, std::streamsize(offset - uint64_t(file.tellp())));
+	};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	pad(header.time_offset);
+	file.write(reinterpret_cast<const char*>(keys.times.data()), std::streamsize(nkeys * sizeof(float)));
+	pad(header.rel_rot_offset);
+	// The rotations are nearly all of the file, report progress through them.
+	const int kKeysPerWrite = 1024;
+	for (int i = 0; i < nkeys && file; i += kKeysPerWrite) {
+		int n = std::min(kKeysPerWrite, nkeys - i);
+		file.write(reinterpret_cast<const char*>(keys.relRot(i)),
+		           std::streamsize(size_t(n) * njoints * sizeof(glm::fquat)));
+		if (progress)
+			*progress = float(i + n) / nkeys;
+	}
+	pad(header.root_trans_offset);
+	file.write(reinterpret_cast<const char*>(keys.root_trans.data()), std::streamsize(nkeys * sizeof(glm::vec3)));
+	file.close();
+	if (!file) {
+		std::cerr << "Cannot write animation " << fn << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool loadAnimationBinary(const std::string& fn, Timeline& timeline)
+{
+	timeline.clear();
+	MappedAnimationFile file;
+	if (!file.open(fn))
+		return false;
+	int njoints = file.getNumberOfJoints();
+	int nkeys = file.size();
+	if (timeline.getNumberOfJoints() == 0)
+		timeline.reset(njoints);
+	if (njoints != timeline.getNumberOfJoints()) {
+		std::cerr << fn << " has " << njoints << " joints, the model has "
+		          << timeline.getNumberOfJoints() << std::endl;
+		return false;
+	}
+	const float* time = file.time();
+	if (!std::is_sorted(time, time + nkeys)) {
+		std::cerr << fn << ": keyframe times are not in order" << std::endl;
+		return false;
+	}
+	// The blocks already have the timeline's layout, so this is one copy per block.
+	timeline.insert(0, nkeys, file.relRot(), file.rootTrans(), time);
+	return true;
+}
+
+bool convertAnimationFile(const std::string& from, const std::string& to)
+{
+	Timeline timeline;
+	bool loaded = isBinaryAnimationFile(from) ? loadAnimationBinary(from, timeline)
+	                                          : loadAnimationJson(from, timeline);
+	if (!loaded)
+		return false;
+	return isBinaryAnimationFile(to) ? saveAnimationBinary(to, timeline.keys())
+	                                 : saveAnimationJson(to, timeline.keys());
+}
@@ -0,0 +1,94 @@
+#ifndef ANIMATION_FILE_H
+#define ANIMATION_FILE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "mapped_file.h"
+
+class Timeline;
+struct TimelineKeys;
+
+/*
+ * Binary animation file, native byte order:
+ *
+ *      header
+ *      time        nkeys floats
+ *      rel_rot     nkeys * njoints (x, y, z, w), keyframe after keyframe
+ *      root_trans  nkeys (x, y, z)
+ *
+ * Every block starts at a multiple of kAnimationFileAlignment, so once
+ * the file is mapped the blocks are arrays that can be used in place,
+ * with the same layout Timeline keeps in memory.
+ */
+struct AnimationFileHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t njoints;
+	int32_t nkeys;
+	uint64_t time_offset;
+	uint64_t rel_rot_offset;
+	uint64_t root_trans_offset;
+	uint64_t file_size;
+};
+
+const size_t kAnimationFileAlignment = 64;
+
+/*
+ * Read-only view of an animation file. Where mmap is available the file
+ * is mapped, so opening it only touches the header and the blocks are
+ * paged in as they are read.
+ */
+class MappedAnimationFile {
+public:
+	MappedAnimationFile() = default;
+	MappedAnimationFile(const MappedAnimationFile&) = delete;
+	MappedAnimationFile& operator=(const MappedAnimationFile&) = delete;
+	~MappedAnimationFile() { close(); }
+
+	bool open(const std::string& fn); // Checks the header and the block bounds
+	void close();
+	bool isOpen() const { return header_ != nullptr; }
+
+	int getNumberOfJoints() const { return header_->njoints; }
+	int size() const { return header_->nkeys; }
+	const float* time() const;
+	const glm::fquat* relRot(int index = 0) const;
+	const glm::vec3* rootTrans() const;
+
+private:
+	const AnimationFileHeader* header_ = nullptr;
+	MappedFile file_;
+};
+
+bool isBinaryAnimationFile(const std::string& fn); // By extension, .vma
+bool isMotionFile(const std::string& fn); // By extension, .vmd, imported through the model
+
+/*
+ * The savers take the keys rather than the timeline, so they can write a
+ * snapshot on another thread. If progress is given it is raised from 0
+ * to 1 as the file is written.
+ *
+ * A timeline with no joints takes the joint count of the file, otherwise
+ * the counts have to match. The loaders leave the timeline empty on
+ * failure.
+ */
+bool saveAnimationBinary(const std::string& fn, const TimelineKeys& keys, std::atomic<float>* progress = nullptr);
+bool loadAnimationBinary(const std::string& fn, Timeline& timeline);
+
+/*
+ * The JSON layout written by Mesh::saveAnimationTo before the binary one.
+ */
+bool saveAnimationJson(const std::string& fn, const TimelineKeys& keys, std::atomic<float>* progress = nullptr);
+bool loadAnimationJson(const std::string& fn, Timeline& timeline);
+
+/*
+ * Converts between the two layouts, picking each by extension.
+ */
+bool convertAnimationFile(const std::string& from, const std::string& to);
+
+#endif
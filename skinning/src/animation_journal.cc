@@ -0,0 +1,495 @@
+#include "animation_journal.h"
+#include "animation_saver.h"
+#include "timeline.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	/*
+	 * File layout, native byte order: a JournalHeader, then records, each
+	 * a RecordHeader followed by size bytes of payload. A payload starts
+	 * with its RecordType.
+	 *
+	 *      kInsert     index, time, root_trans, njoints rotations
+	 *      kSet        index, root_trans, njoints rotations
+	 *      kErase      index, count
+	 *      kShiftTimes begin, delta
+	 *      kRetain     count, count keep flags
+	 *      kSnapshot   TimelineKeys::hash() of a compaction snapshot
+	 */
+	struct JournalHeader {
+		char magic[4];
+		uint32_t version;
+		int32_t njoints;
+		int32_t reserved;
+		uint64_t base_size;
+		int64_t base_mtime;
+	};
+
+	struct RecordHeader {
+		uint32_t size;
+		uint32_t crc;
+	};
+
+	enum RecordType : uint32_t {
+		kInsert = 1,
+		kSet,
+		kErase,
+		kShiftTimes,
+		kRetain,
+		kSnapshot,
+	};
+
+	const char kMagic[4] = { 'V', 'M', 'J', 'R' };
+	const uint32_t kVersion = 1;
+
+	uint32_t crc32(const char* data, size_t n)
+	{
+		static uint32_t table[256];
+		static bool initialized = false;
+		if (!initialized) {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				table[i] = c;
+			}
+			initialized = true;
+		}
+		uint32_t crc = 0xFFFFFFFFu;
+		for (size_t i = 0; i < n; i++)
+			crc = table[(crc ^ uint8_t(data[i])) & 0xFF] ^ (crc >> 8);
+		return crc ^ 0xFFFFFFFFu;
+	}
+
+	bool statFile(const std::string& fn, uint64_t& size, int64_t& mtime)
+	{
+		struct stat st;
+		if (stat(fn.c_str(), &st) != 0)
+			return false;
+		size = uint64_t(st.st_size);
+#ifdef __linux__
+		mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+		mtime = int64_t(st.st_mtime);
+#endif
+		return true;
+	}
+
+	bool syncFile(FILE* file)
+	{
+		if (std::fflush(file) != 0)
+			return false;
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	/*
+	 * Drops whatever a failed write left after the first size bytes.
+	 */
+	bool truncateFile(FILE* file, uint64_t size)
+	{
+		if (std::fflush(file) != 0)
+			return false;
+#ifdef _WIN32
+		return _chsize_s(_fileno(file), int64_t(size)) == 0;
+#else
+		return ftruncate(fileno(file), off_t(size)) == 0;
+#endif
+	}
+
+	template<typename T>
+	void put(std::vector<char>& out, const T& value)
+	{
+		const char* p = reinterpret_cast<const char*>(&value);
+		out.insert(out.end(), p, p + sizeof(T));
+	}
+
+	template<typename T>
+	void putArray(std::vector<char>& out, const T* values, size_t n)
+	{
+		const char* p = reinterpret_cast<const char*>(values);
+		out.insert(out.end(), p, p + n * sizeof(T));
+	}
+
+	/*
+	 * Reads a payload; every get fails once the payload is used up.
+	 */
+	struct PayloadReader {
+		const char* p;
+		const char* end;
+
+		template<typename T>
+		bool get(T& value)
+		{
+			return getArray(&value, 1);
+		}
+
+		template<typename T>
+		bool getArray(T* values, size_t n)
+		{
+			if (size_t(end - p) < n * sizeof(T))
+				return false;
+			std::memcpy(values, p, n * sizeof(T));
+			p += n * sizeof(T);
+			return true;
+		}
+
+		bool done() const { return p == end; }
+	};
+
+	/*
+	 * Offset of the record after the one at offset, or 0 if that one is
+	 * missing, cut short by a crash or fails its checksum.
+	 */
+	size_t nextRecord(const std::vector<char>& data, size_t offset)
+	{
+		if (data.size() - offset < sizeof(RecordHeader))
+			return 0;
+		RecordHeader record;
+		std::memcpy(&record, data.data() + offset, sizeof(record));
+		const char* payload = data.data() + offset + sizeof(record);
+		if (data.size() - offset - sizeof(record) < record.size ||
+		    crc32(payload, record.size) != record.crc)
+			return 0;
+		return offset + sizeof(record) + record.size;
+	}
+
+	/*
+	 * Offset of the records made after the last compaction snapshot with
+	 * keys_hash, or 0 if the journal has none.
+	 */
+	size_t afterSnapshot(const std::vector<char>& data, uint64_t keys_hash)
+	{
+		size_t found = 0;
+		size_t next;
+		for (size_t offset = sizeof(JournalHeader); (next = nextRecord(data, offset)) != 0; offset = next) {
+			PayloadReader in{ data.data() + offset + sizeof(RecordHeader), data.data() + next };
+			uint32_t type;
+			uint64_t hash;
+			if (in.get(type) && type == kSnapshot && in.get(hash) && in.done() && hash == keys_hash)
+				found = next;
+		}
+		return found;
+	}
+
+	/*
+	 * Applies one record, checking that it fits the timeline.
+	 */
+	bool applyRecord(PayloadReader in, Timeline& timeline, std::vector<glm::fquat>& rel_rot)
+	{
+		int size = timeline.size();
+		uint32_t type;
+		int32_t index, count;
+		float time;
+		glm::vec3 root_trans;
+		if (!in.get(type))
+			return false;
+		switch (type) {
+		case kInsert:
+			if (!in.get(index) || !in.get(time) || !in.get(root_trans) ||
+			    !in.getArray(rel_rot.data(), rel_rot.size()) || !in.done() ||
+			    index < 0 || index > size)
+				return false;
+			timeline.insert(index, 1, rel_rot.data(), &root_trans, &time);
+			return true;
+		case kSet:
+			if (!in.get(index) || !in.get(root_trans) ||
+			    !in.getArray(rel_rot.data(), rel_rot.size()) || !in.done() ||
+			    index < 0 || index >= size)
+				return false;
+			timeline.set(index, rel_rot.data(), root_trans);
+			return true;
+		case kErase:
+			if (!in.get(index) || !in.get(count) || !in.done() ||
+			    index < 0 || count < 0 || index + count > size)
+				return false;
+			timeline.erase(index, count);
+			return true;
+		case kShiftTimes:
+			if (!in.get(index) || !in.get(time) || !in.done() || index < 0 || index > size)
+				return false;
+			timeline.shiftTimes(index, time);
+			return true;
+		case kRetain: {
+			if (!in.get(count) || count != size)
+				return false;
+			std::vector<char> keep(count);
+			if (!in.getArray(keep.data(), keep.size()) || !in.done())
+				return false;
+			timeline.retain(keep);
+			return true;
+		}
+		case kSnapshot: {
+			uint64_t keys_hash;
+			return in.get(keys_hash) && in.done();
+		}
+		default:
+			return false;
+		}
+	}
+}
+
+AnimationJournal::~AnimationJournal()
+{
+	detach();
+}
+
+int AnimationJournal::attach(const std::string& base, Timeline& timeline)
+{
+	detach();
+	njoints_ = timeline.getNumberOfJoints();
+	uint64_t base_size;
+	int64_t base_mtime;
+	if (!statFile(base, base_size, base_mtime)) {
+		std::cerr << "Cannot journal edits to " << base << ", it does not exist" << std::endl;
+		return 0;
+	}
+
+	std::string fn = base + ".journal";
+	std::vector<char> data;
+	std::ifstream file(fn, std::ios::binary);
+	if (file)
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	// A journal written for an earlier version of base still applies from
+	// the snapshot that base was written from, if the process died before
+	// the compaction finished.
+	int replayed = 0;
+	size_t start = sizeof(JournalHeader);
+	bool usable = false;
+	bool current = false;
+	if (data.size() >= sizeof(JournalHeader)) {
+		JournalHeader header;
+		std::memcpy(&header, data.data(), sizeof(header));
+		usable = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+		         header.version == kVersion && header.njoints == njoints_;
+		current = usable && header.base_size == base_size && header.base_mtime == base_mtime;
+		if (usable && !current) {
+			start = afterSnapshot(data, timeline.keys().hash());
+			usable = start != 0;
+		}
+		if (!usable)
+			std::cerr << fn << " does not belong to " << base << " as saved, ignoring it" << std::endl;
+	}
+	size_t valid = start;
+	if (usable) {
+		std::vector<glm::fquat> rel_rot(njoints_);
+		size_t next;
+		while ((next = nextRecord(data, valid)) != 0) {
+			const char* payload = data.data() + valid + sizeof(RecordHeader);
+			if (!applyRecord(PayloadReader{ payload, data.data() + next }, timeline, rel_rot)) {
+				std::cerr << fn << ": edit " << replayed << " does not apply, dropping it and the rest" << std::endl;
+				break;
+			}
+			valid = next;
+			replayed++;
+		}
+	}
+
+	if (current && valid == data.size()) {
+		file_ = std::fopen(fn.c_str(), "ab");
+		base_ = base;
+		base_size_ = base_size;
+		written_ = valid - sizeof(JournalHeader);
+	} else {
+		std::vector<char> records;
+		if (usable)
+			records.assign(data.begin() + start, data.begin() + valid);
+		startJournal(base, records);
+	}
+	return replayed;
+}
+
+void AnimationJournal::detach()
+{
+	flush();
+	if (file_)
+		std::fclose(file_);
+	file_ = nullptr;
+	base_.clear();
+	written_ = 0;
+	torn_ = false;
+	batch_.clear();
+}
+
+void AnimationJournal::recordInsert(const Timeline& timeline, int index)
+{
+	if (!isRecording())
+		return;
+	std::vector<char> payload;
+	put(payload, uint32_t(kInsert));
+	put(payload, int32_t(index));
+	put(payload, timeline.time(index));
+	put(payload, timeline.rootTrans(index));
+	putArray(payload, timeline.relRot(index), timeline.getNumberOfJoints());
+	append(payload);
+}
+
+void AnimationJournal::recordSet(const Timeline& timeline, int index)
+{
+	if (!isRecording())
+		return;
+	std::vector<char> payload;
+	put(payload, uint32_t(kSet));
+	put(payload, int32_t(index));
+	put(payload, timeline.rootTrans(index));
+	putArray(payload, timeline.relRot(index), timeline.getNumberOfJoints());
+	append(payload);
+}
+
+void AnimationJournal::recordErase(int index, int count)
+{
+	if (!isRecording())
+		return;
+	std::vector<char> payload;
+	put(payload, uint32_t(kErase));
+	put(payload, int32_t(index));
+	put(payload, int32_t(count));
+	append(payload);
+}
+
+void AnimationJournal::recordShiftTimes(int begin, float delta)
+{
+	if (!isRecording())
+		return;
+	std::vector<char> payload;
+	put(payload, uint32_t(kShiftTimes));
+	put(payload, int32_t(begin));
+	put(payload, delta);
+	append(payload);
+}
+
+void AnimationJournal::recordRetain(const std::vector<char>& keep)
+{
+	if (!isRecording())
+		return;
+	std::vector<char> payload;
+	put(payload, uint32_t(kRetain));
+	put(payload, int32_t(keep.size()));
+	putArray(payload, keep.data(), keep.size());
+	append(payload);
+}
+
+bool AnimationJournal::flush()
+{
+	if (!file_ || batch_.empty())
+		return true;
+	// Replay would stop at what a failed write left behind, so that is cut
+	// off and the batch written again.
+	bool ok = (!torn_ || truncateFile(file_, sizeof(JournalHeader) + written_)) &&
+	          std::fwrite(batch_.data(), 1, batch_.size(), file_) == batch_.size() && syncFile(file_);
+	if (!ok) {
+		std::cerr << "Cannot write " << base_ << ".journal" << std::endl;
+		torn_ = true;
+		batch_start_ = std::chrono::steady_clock::now(); // Try again a batch later
+		return false;
+	}
+	torn_ = false;
+	written_ += batch_.size();
+	batch_.clear();
+	return true;
+}
+
+bool AnimationJournal::flushIfOlderThan(float seconds)
+{
+	if (batch_.empty() || std::chrono::steady_clock::now() - batch_start_ < std::chrono::duration<float>(seconds))
+		return true;
+	return flush();
+}
+
+bool AnimationJournal::needsCompaction() const
+{
+	const uint64_t kMinimumBytes = 64 * 1024;
+	return isAttached() && written_ + batch_.size() > std::max(base_size_ / 4, kMinimumBytes);
+}
+
+void AnimationJournal::beginCompaction(const Timeline& timeline)
+{
+	if (isAttached()) {
+		std::vector<char> payload;
+		put(payload, uint32_t(kSnapshot));
+		put(payload, timeline.keys().hash());
+		append(payload);
+	}
+	flush();
+	njoints_ = timeline.getNumberOfJoints();
+	compacting_ = true;
+	since_snapshot_.clear();
+}
+
+void AnimationJournal::finishCompaction(const std::string& base, bool succeeded)
+{
+	if (!compacting_)
+		return;
+	compacting_ = false;
+	if (succeeded) {
+		// The old journal described the old file, the records made since
+		// the snapshot start the new one.
+		detach();
+		startJournal(base, since_snapshot_);
+	}
+	since_snapshot_.clear();
+}
+
+void AnimationJournal::append(const std::vector<char>& payload)
+{
+	std::vector<char> record;
+	put(record, RecordHeader{ uint32_t(payload.size()), crc32(payload.data(), payload.size()) });
+	record.insert(record.end(), payload.begin(), payload.end());
+	if (file_) {
+		if (batch_.empty())
+			batch_start_ = std::chrono::steady_clock::now();
+		batch_.insert(batch_.end(), record.begin(), record.end());
+	}
+	if (compacting_)
+		since_snapshot_.insert(since_snapshot_.end(), record.begin(), record.end());
+}
+
+bool AnimationJournal::startJournal(const std::string& base, const std::vector<char>& records)
+{
+	JournalHeader header;
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.njoints = njoints_;
+	header.reserved = 0;
+	if (!statFile(base, header.base_size, header.base_mtime)) {
+		std::cerr << "Cannot journal edits to " << base << ", it does not exist" << std::endl;
+		return false;
+	}
+
+	std::string fn = base + ".journal";
+	std::string tmp = fn + ".tmp";
+	FILE* file = std::fopen(tmp.c_str(), "wb");
+	if (!file) {
+		std::cerr << "Cannot write " << tmp << std::endl;
+		return false;
+	}
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+	          std::fwrite(records.data(), 1, records.size(), file) == records.size() &&
+	          syncFile(file);
+	std::fclose(file);
+	if (!ok || !replaceFile(tmp, fn)) {
+		std::cerr << "Cannot write " << fn << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+
+	file_ = std::fopen(fn.c_str(), "ab");
+	base_ = base;
+	base_size_ = header.base_size;
+	written_ = records.size();
+	return file_ != nullptr;
+}
@@ -0,0 +1,93 @@
+#ifndef ANIMATION_JOURNAL_H
+#define ANIMATION_JOURNAL_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class Timeline;
+
+/*
+ * Append-only log of keyframe edits, kept next to an animation file as
+ * fn + ".journal". Loading the animation replays the journal on top of
+ * it, so saving an edit only costs the bytes of that edit.
+ *
+ * Every record carries a CRC32 of its payload. Records are collected in
+ * memory and written and fsynced together by flush(), so a crash loses
+ * at most the batch that was not flushed yet; a record cut short by the
+ * crash fails its checksum and replay stops there.
+ *
+ * The journal header names the animation file it applies to by its size
+ * and modification time, so a journal is ignored once the animation file
+ * is replaced behind its back. Writing the full animation file again
+ * compacts the journal: beginCompaction() when the snapshot for the save
+ * is taken, finishCompaction() when the file is in place. Edits made in
+ * between are carried over into the new journal. The old journal is only
+ * reset if the save succeeded, which writeAnimationSnapshot() reports once
+ * the file is on disk.
+ *
+ * beginCompaction() also marks the journal with a hash of the snapshot's
+ * keys. If the process dies after the new file is in place but before
+ * finishCompaction(), attach() finds the mark matching the loaded keys
+ * and replays the edits made after it.
+ */
+class AnimationJournal {
+public:
+	AnimationJournal() = default;
+	AnimationJournal(const AnimationJournal&) = delete;
+	AnimationJournal& operator=(const AnimationJournal&) = delete;
+	~AnimationJournal(); // Flushes
+
+	/*
+	 * Replays the journal of base onto timeline, which has to hold what
+	 * was just loaded from base, then keeps journaling to it. Returns the
+	 * number of edits replayed.
+	 */
+	int attach(const std::string& base, Timeline& timeline);
+	void detach();
+	bool isAttached() const { return file_ != nullptr; }
+	const std::string& baseFile() const { return base_; }
+
+	/*
+	 * Called after the matching Timeline edit.
+	 */
+	void recordInsert(const Timeline& timeline, int index);
+	void recordSet(const Timeline& timeline, int index);
+	void recordErase(int index, int count);
+	void recordShiftTimes(int begin, float delta);
+	void recordRetain(const std::vector<char>& keep);
+
+	bool flush();
+	bool flushIfOlderThan(float seconds); // Flushes a batch started that long ago
+	size_t bytesWritten() const { return written_; }
+
+	/*
+	 * Once the journal outgrows a quarter of the animation file it is
+	 * cheaper to write the file again.
+	 */
+	bool needsCompaction() const;
+	bool isCompacting() const { return compacting_; }
+	void beginCompaction(const Timeline& timeline);
+	void finishCompaction(const std::string& base, bool succeeded);
+
+private:
+	bool isRecording() const { return file_ != nullptr || compacting_; }
+	void append(const std::vector<char>& payload);
+	bool startJournal(const std::string& base, const std::vector<char>& records);
+
+	std::string base_;
+	int njoints_ = 0;
+	FILE* file_ = nullptr;
+	uint64_t base_size_ = 0;
+	size_t written_ = 0; // Bytes of records written and synced
+	bool torn_ = false;  // A failed flush may have left part of a batch behind
+	std::vector<char> batch_;
+	std::chrono::steady_clock::time_point batch_start_;
+
+	bool compacting_ = false;
+	std::vector<char> since_snapshot_; // Records made after the compaction snapshot
+};
+
+#endif
@@ -1,5 +1,11 @@
 #include "bone_geometry.h"
-#include "texture_to_render.h"
+#include "animation_file.h"
+#include "animation_saver.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <glm/gtx/io.hpp>
@@ -12,136 +18,347 @@
 
 #include <string>
 
-extern int preview_width;
-extern int preview_height;
 
-using json = nlohmann::json;
-namespace {
-	const glm::fquat identity(1.0, 0.0, 0.0, 0.0);
-}
+/*
+ * Numbers are read straight into floats, which is all a keyframe stores.
+ */
+using json = nlohmann::basic_json<std::map, std::vector, std::string, bool,
+                                  std::int64_t, std::uint64_t, float>;
 
-json createQuaternionObject(glm::fquat quat) {
-	json output;
-	output["x"] = quat.x;
-	output["y"] = quat.y;
-	output["z"] = quat.z;
-	output["w"] = quat.w;
-	return output;
-}
+/*
+ * The writer streams one keyframe at a time instead of building the whole
+ * document first. The layout is the same as before, without indentation:
+ *
+ *      {"0":{"0":{"rel_orientation":{"x":..,"y":..,"z":..,"w":..}},
+ *            "1":..., "root_trans":{"x":..,"y":..,"z":..}, "time":..},
+ *       "1":...}
+ */
+namespace {
+	void appendFloat(std::string& out, float value)
+	{
+		char buf[32];
+		int n = std::snprintf(buf, sizeof(buf), "%.9g", value); // round trips a float
+		out.append(buf, n);
+	}
 
-json createMatrixObject(glm::mat4 mat) {
-	json output;
-	for (int i = 0; i < 16; i++) {
-		output[std::to_string(i)] = mat[i/4][i%4];
+	void appendVector(std::string& out, const glm::vec3& vec)
+	{
+		out += "{\"x\":";
+		appendFloat(out, vec.x);
+		out += ",\"y\":";
+		appendFloat(out, vec.y);
+		out += ",\"z\":";
+		appendFloat(out, vec.z);
+		out += '}';
 	}
-	return output;
-}
 
-json createJointObject(Keyframe* keyframe, int i) {
-	json output;
-	output["T"] = createMatrixObject(keyframe->T[i]);
-	output["D"] = createMatrixObject(keyframe->D[i]);
-	output["U"] = createMatrixObject(keyframe->U[i]);
-	output["orientation"] = createQuaternionObject(keyframe->orientation[i]);
-	output["rel_orientation"] = createQuaternionObject(keyframe->rel_orientation[i]);
-	return output;
-}
+	void appendKeyframe(std::string& out, const TimelineKeys& keys, int keyframeid)
+	{
+		const glm::fquat* rel_rot = keys.relRot(keyframeid);
+		out += '"';
+		out += std::to_string(keyframeid);
+		out += "\":{";
+		for (int i = 0; i < keys.getNumberOfJoints(); i++) {
+			const glm::fquat& q = rel_rot[i];
+			out += '"';
+			out += std::to_string(i);
+			out += "\":{\"rel_orientation\":{\"x\":";
+			appendFloat(out, q.x);
+			out += ",\"y\":";
+			appendFloat(out, q.y);
+			out += ",\"z\":";
+			appendFloat(out, q.z);
+			out += ",\"w\":";
+			appendFloat(out, q.w);
+			out += "}},";
+		}
+		out += "\"root_trans\":";
+		appendVector(out, keys.rootTrans(keyframeid));
+		out += ",\"time\":";
+		appendFloat(out, keys.time(keyframeid));
+		out += '}';
+	}
 
-json createKeyframeObject(Keyframe* keyframe) {
-	json output;
-	for (int i = 0; i < (int)keyframe->T.size(); i++) {
-		output[std::to_string(i)] = createJointObject(keyframe, i);
+	/*
+	 * JSON has no NaN or infinity, so a keyframe holding one could not be
+	 * read back.
+	 */
+	bool isFinite(const TimelineKeys& keys, int keyframeid)
+	{
+		const float* rel_rot = &keys.relRot(keyframeid)->x;
+		for (int i = 0; i < 4 * keys.getNumberOfJoints(); i++)
+			if (!std::isfinite(rel_rot[i]))
+				return false;
+		const glm::vec3& trans = keys.rootTrans(keyframeid);
+		return std::isfinite(trans.x) && std::isfinite(trans.y) && std::isfinite(trans.z) &&
+		       std::isfinite(keys.time(keyframeid));
 	}
-	return output;
 }
 
-void Mesh::saveAnimationTo(const std::string& fn)
+bool saveAnimationJson(const std::string& fn, const TimelineKeys& keys, std::atomic<float>* progress)
 {
-	// FIXME: Save keyframes to json file.
 	std::ofstream jsonfile;
-	jsonfile.open(fn);
-	json output;
-	for (int i = 0; i < (int)keyframes.size(); i++) {
-		Keyframe* keyframe = keyframes[i];
-		output[std::to_string(i)] = createKeyframeObject(keyframe);
+	jsonfile.open(fn, std::ios::binary);
+	if (!jsonfile) {
+		std::cerr << "Cannot write animation " << fn << std::endl;
+		return false;
+	}
+	std::string line;
+	jsonfile << '{';
+	for (int i = 0; i < keys.size(); i++) {
+		if (!isFinite(keys, i)) {
+			std::cerr << "Cannot write animation " << fn << ", keyframe " << i
+			          << " is not finite" << std::endl;
+			return false;
+		}
+		line.clear();
+		if (i > 0)
+			line += ",\n";
+		appendKeyframe(line, keys, i);
+		jsonfile.write(line.data(), line.size());
+		if (progress)
+			*progress = float(i + 1) / keys.size();
 	}
-	jsonfile << output.dump(4);
+	jsonfile << "}\n";
 	jsonfile.close();
+	if (!jsonfile) {
+		std::cerr << "Cannot write animation " << fn << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * The format follows the extension, see animation_file.h. Writing the
+ * whole file starts a new journal.
+ */
+void Mesh::saveAnimationTo(const std::string& fn)
+{
+	journal.beginCompaction(timeline);
+	journal.finishCompaction(fn, writeAnimationSnapshot(snapshotAnimation(), fn));
 }
 
-glm::fquat loadQuaternion(json input)
+AnimationSnapshot Mesh::snapshotAnimation() const
 {
-	glm::fquat output;
-	output.x = input["x"];
-	output.y = input["y"];
-	output.z = input["z"];
-	output.w = input["w"];
-	return output;
+	AnimationSnapshot snapshot;
+	snapshot.keys = timeline.snapshot();
+	if (isBakeCurrent())
+		snapshot.baked_clip = baked_clip;
+	if (isCompressedCurrent())
+		snapshot.compressed_clip = compressed_clip;
+	return snapshot;
 }
 
-glm::mat4 loadMatrix(json input)
+/*
+ * The loaders return false if a member is missing or not a number.
+ */
+bool loadNumber(const json& input, const std::string& key, float& output)
+{
+	auto it = input.find(key);
+	if (it == input.end() || !it->is_number())
+		return false;
+	output = it->get<float>();
+	return true;
+}
+
+bool loadQuaternion(const json& input, glm::fquat& output)
+{
+	return loadNumber(input, "x", output.x) && loadNumber(input, "y", output.y) &&
+	       loadNumber(input, "z", output.z) && loadNumber(input, "w", output.w);
+}
+
+bool loadMatrix(const json& input, glm::mat4& output)
 {
-	glm::mat4 output = glm::mat4(0.0f);
 	for (int i = 0; i < 16; i++) {
-		output[i / 4][i % 4] = input[std::to_string(i)];
+		if (!loadNumber(input, std::to_string(i), output[i / 4][i % 4]))
+			return false;
 	}
-	return output;
+	return true;
+}
+
+bool loadVector(const json& input, glm::vec3& output)
+{
+	return loadNumber(input, "x", output.x) && loadNumber(input, "y", output.y) &&
+	       loadNumber(input, "z", output.z);
 }
 
-Keyframe* loadKeyframe(json input, int preview_width_, int preview_height_)
+/*
+ * Older files also store T, D, U and orientation for every joint. Only
+ * rel_orientation is needed, the rest is recomputed by forward kinematics.
+ */
+bool loadKeyframe(const json& input, std::vector<glm::fquat>& rel_rot, glm::vec3& root_trans, float& time)
 {
-	Keyframe* output = new Keyframe();
-	output->T.clear();
-	output->U.clear();
-	output->D.clear();
-	output->rel_orientation.clear();
-	output->orientation.clear();
-	for (int i = 0; i < input.size(); i++) {
-		int j = 0;
-		//std::cerr << input[std::to_string(i)] << std::endl;
-		json it = input[std::to_string(i)];
-		output->T.push_back(loadMatrix(it["T"]));
-		output->D.push_back(loadMatrix(it["D"]));
-		output->U.push_back(loadMatrix(it["U"]));
-		output->orientation.push_back(loadQuaternion(it["orientation"]));
-		output->rel_orientation.push_back(loadQuaternion(it["rel_orientation"]));
-		/*for (auto it1: it) {
-			switch (j)
-			{
-				case 0: output->T.push_back(loadMatrix(it1));  break;
-				case 1: output->D.push_back(loadMatrix(it1)); break;
-				case 2: output->U.push_back(loadMatrix(it1)); break;
-				case 3: output->orientation.push_back(loadQuaternion(it1));  break;
-				case 4: output->rel_orientation.push_back(loadQuaternion(it1)); break;
-			}
-			j++;
-		}*/
-		//i++;
+	rel_rot.clear();
+	for (int i = 0; ; i++) {
+		auto it = input.find(std::to_string(i));
+		if (it == input.end())
+			break;
+		glm::fquat q;
+		auto rel_orientation = it->find("rel_orientation");
+		auto T = it->find("T");
+		glm::mat4 m;
+		if (rel_orientation != it->end()) {
+			if (!loadQuaternion(*rel_orientation, q))
+				return false;
+		} else if (T != it->end() && loadMatrix(*T, m)) {
+			q = glm::quat_cast(m);
+		} else {
+			return false;
+		}
+		// Timeline::insert normalizes, keeping keys that were saved unit
+		// length bit for bit.
+		if (!(glm::length(q) > 0.0f))
+			return false;
+		rel_rot.push_back(q);
 	}
-	output->texture.create(preview_width_, preview_height_);
-	return output;
+	root_trans = glm::vec3(0.0f);
+	auto it = input.find("root_trans");
+	if (it != input.end() && !loadVector(*it, root_trans))
+		return false;
+	if (input.count("time") && !loadNumber(input, "time", time))
+		return false;
+	return true;
 }
 
-void Mesh::loadAnimationFrom(const std::string& fn)
+/*
+ * The parser hands every keyframe object to the callback as soon as it is
+ * complete, and the callback discards it, so only one keyframe is ever
+ * held as json. Keys of files written through a json object are in string
+ * order ("0", "1", "10", ...), so keyframes are placed by their key and
+ * moved into the timeline once all of them are known.
+ *
+ * The shortest joint a file can hold, "0":{"rel_orientation":{"x":0,...}},
+ * takes more than kMinJointBytes, which bounds the keyframe ids a file of
+ * a given size can have before any space is reserved for them.
+ */
+const size_t kMinJointBytes = 40;
+
+bool loadAnimationJson(const std::string& fn, Timeline& timeline)
 {
-	// FIXME: Load keyframes from json file.
+	timeline.clear();
 	std::ifstream jsonfile;
-	jsonfile.open(fn);
-	json input;
-	jsonfile >> input;
-	//for (json::iterator it = input.begin(); it != input.end(); ++it) {
-	//	//std::cerr << it.key() << " : " << it.value() << "\n" << std::endl;
-	//	std::cerr << it.key() << std::endl;
-	//}
-	keyframes.clear();
-	for (int i = 0; i < input.size(); i++)
-	{
-		// "it" is of type json::reference and has no key() member
-		/*std::cerr << it << '\n';*/
-		keyframes.push_back(loadKeyframe(input[std::to_string(i)], preview_width, preview_height));
+	jsonfile.open(fn, std::ios::binary);
+	if (!jsonfile) {
+		std::cerr << "Cannot open " << fn << std::endl;
+		return false;
 	}
-	/*if (input.find("0") != input.end()) {
-		std::cerr << "Here" << std::endl;
-	}*/
-	jsonfile.close();
+	jsonfile.seekg(0, std::ios::end);
+	size_t file_size = size_t(jsonfile.tellg());
+	jsonfile.seekg(0, std::ios::beg);
+
+	int njoints = timeline.getNumberOfJoints();
+	std::vector<glm::fquat> rel_rot, keyframe_rot;
+	std::vector<glm::vec3> root_trans;
+	std::vector<float> times;
+	std::vector<char> seen;
+	int keyframeid = -1;
+	bool failed = false;
+	auto callback = [&](int depth, json::parse_event_t event, json& parsed) {
+		if (depth != 1 || failed)
+			return true;
+		if (event == json::parse_event_t::key) {
+			const std::string& key = parsed.get_ref<const std::string&>();
+			char* end;
+			long id = std::strtol(key.c_str(), &end, 10);
+			keyframeid = (*end == '\0' && id >= 0 && id < INT_MAX) ? int(id) : -1;
+			return true;
+		}
+		if (event != json::parse_event_t::object_end || keyframeid < 0)
+			return true;
+
+		float time = float(keyframeid); // files without timestamps have one keyframe per second
+		glm::vec3 trans;
+		if (!loadKeyframe(parsed, keyframe_rot, trans, time)) {
+			std::cerr << fn << ": keyframe " << keyframeid << " has a missing or bad value" << std::endl;
+			failed = true;
+			return false;
+		}
+		if (njoints == 0)
+			njoints = int(keyframe_rot.size());
+		if ((int)keyframe_rot.size() != njoints) {
+			std::cerr << fn << ": keyframe " << keyframeid << " has " << keyframe_rot.size()
+			          << " joints, the model has " << njoints << std::endl;
+			failed = true;
+			return false;
+		}
+		if (size_t(keyframeid) >= file_size / (std::max(njoints, 1) * kMinJointBytes) + 1) {
+			std::cerr << fn << ": keyframe " << keyframeid << " cannot be in a file of "
+			          << file_size << " bytes" << std::endl;
+			failed = true;
+			return false;
+		}
+		if (keyframeid >= (int)seen.size()) {
+			seen.resize(keyframeid + 1, 0);
+			times.resize(keyframeid + 1);
+			root_trans.resize(keyframeid + 1);
+			rel_rot.resize(size_t(keyframeid + 1) * njoints);
+		}
+		seen[keyframeid] = 1;
+		times[keyframeid] = time;
+		root_trans[keyframeid] = trans;
+		std::copy(keyframe_rot.begin(), keyframe_rot.end(), rel_rot.begin() + size_t(keyframeid) * njoints);
+		return false; // Done with it, drop it from the document
+	};
+	json input = json::parse(jsonfile, callback, false);
+	if (failed)
+		return false;
+	if (input.is_discarded()) {
+		std::cerr << fn << " is not valid JSON" << std::endl;
+		return false;
+	}
+
+	int nkeys = int(seen.size());
+	for (int i = 0; i < nkeys; i++) {
+		if (!seen[i]) {
+			std::cerr << fn << ": keyframe " << i << " is missing" << std::endl;
+			return false;
+		}
+		if (i > 0 && times[i] < times[i - 1]) {
+			std::cerr << fn << ": keyframe " << i << " is earlier than the one before it" << std::endl;
+			return false;
+		}
+	}
+	if (timeline.getNumberOfJoints() == 0)
+		timeline.reset(njoints);
+	timeline.insert(0, nkeys, rel_rot.data(), root_trans.data(), times.data());
+	return true;
+}
+
+void Mesh::loadAnimationFrom(const std::string& fn)
+{
+	bool loaded;
+	if (isMotionFile(fn))
+		loaded = importMotion(fn);
+	else if (isBinaryAnimationFile(fn))
+		loaded = loadAnimationBinary(fn, timeline);
+	else
+		loaded = loadAnimationJson(fn, timeline);
+
+	// Clips next to the animation are used if they were made from the
+	// keys just loaded. Motions are imported and never have any.
+	baked_clip.reset();
+	compressed_clip.reset();
+	if (loaded && !isMotionFile(fn)) {
+		uint64_t keys_hash = timeline.keys().hash();
+		auto baked = std::make_shared<BakedClip>();
+		if (baked->loadFrom(fn + ".bake", keys_hash) && baked->njoints == timeline.getNumberOfJoints()) {
+			baked->revision = timeline.revision();
+			baked_clip = std::move(baked);
+		}
+		auto compressed = std::make_shared<CompressedClip>();
+		if (compressed->loadFrom(fn + ".vmc", keys_hash) && compressed->njoints == timeline.getNumberOfJoints()) {
+			compressed->revision = timeline.revision();
+			compressed_clip = std::move(compressed);
+		}
+	}
+
+	// Edits saved since the file was written. Replaying them leaves the
+	// clips out of date, as they should be.
+	int replayed = 0;
+	if (!loaded)
+		journal.detach();
+	else if (!isMotionFile(fn))
+		replayed = journal.attach(fn, timeline);
+	if (replayed > 0)
+		std::cout << "Replayed " << replayed << " edits from " << fn << ".journal" << std::endl;
 }
@@ -0,0 +1,175 @@
+#include "animation_saver.h"
+#include "animation_file.h"
+#include "timeline.h"
+#include "baked_clip.h"
+#include "compressed_clip.h"
+#include <cstdio>
+#include <iostream>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	/*
+	 * Puts the data of fn on disk. The writers close their streams, so
+	 * the file is opened again for it.
+	 */
+	bool syncPath(const std::string& fn)
+	{
+#ifdef _WIN32
+		int fd = _open(fn.c_str(), _O_RDWR | _O_BINARY);
+		if (fd < 0)
+			return false;
+		bool ok = _commit(fd) == 0;
+		_close(fd);
+#else
+		int fd = open(fn.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		bool ok = fsync(fd) == 0;
+		close(fd);
+#endif
+		return ok;
+	}
+
+	/*
+	 * Puts the directory entries of fn's directory on disk, which makes a
+	 * rename into it durable. Windows cannot open a directory for this,
+	 * and NTFS logs renames itself.
+	 */
+	bool syncDirectory(const std::string& fn)
+	{
+#ifdef _WIN32
+		return true;
+#else
+		size_t slash = fn.find_last_of('/');
+		std::string dir = slash == std::string::npos ? "." : fn.substr(0, slash == 0 ? 1 : slash);
+		int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			return false;
+		bool ok = fsync(fd) == 0;
+		close(fd);
+		return ok;
+#endif
+	}
+}
+
+bool replaceFile(const std::string& tmp, const std::string& fn)
+{
+	if (!syncPath(tmp)) {
+		std::cerr << "Cannot write " << tmp << " to disk" << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+	bool renamed = std::rename(tmp.c_str(), fn.c_str()) == 0;
+#ifdef _WIN32
+	if (!renamed) {
+		std::remove(fn.c_str());
+		renamed = std::rename(tmp.c_str(), fn.c_str()) == 0;
+	}
+#endif
+	if (!renamed) {
+		std::cerr << "Cannot replace " << fn << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+	if (!syncDirectory(fn)) {
+		std::cerr << "Cannot write the directory of " << fn << " to disk" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+namespace {
+	template<typename Clip>
+	bool writeSideFile(const std::shared_ptr<const Clip>& clip, uint64_t keys_hash, const std::string& fn)
+	{
+		if (!clip) {
+			std::remove(fn.c_str());
+			return true;
+		}
+		std::string tmp = fn + ".tmp";
+		if (!clip->saveTo(tmp, keys_hash)) {
+			std::remove(tmp.c_str());
+			return false;
+		}
+		return replaceFile(tmp, fn);
+	}
+}
+
+bool writeAnimationSnapshot(const AnimationSnapshot& snapshot, const std::string& fn,
+                            std::atomic<float>* progress)
+{
+	if (progress)
+		*progress = 0.0f;
+	// Clips name the keys they were made from, so clips left next to
+	// another version of the animation, e.g. when writing it fails
+	// below, are refused when it is loaded. The animation goes last, so
+	// once it is in place its clips are too.
+	uint64_t keys_hash = 0;
+	if (snapshot.baked_clip || snapshot.compressed_clip)
+		keys_hash = snapshot.keys->hash();
+	bool ok = writeSideFile(snapshot.baked_clip, keys_hash, fn + ".bake");
+	ok = writeSideFile(snapshot.compressed_clip, keys_hash, fn + ".vmc") && ok;
+
+	std::string tmp = fn + ".tmp";
+	bool written = isBinaryAnimationFile(fn) ? saveAnimationBinary(tmp, *snapshot.keys, progress)
+	                                         : saveAnimationJson(tmp, *snapshot.keys, progress);
+	if (!written) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return replaceFile(tmp, fn) && ok;
+}
+
+AnimationSaver::~AnimationSaver()
+{
+	if (worker_.joinable())
+		worker_.join();
+	if (waiting_)
+		writeAnimationSnapshot(waiting_snapshot_, waiting_fn_);
+}
+
+void AnimationSaver::save(const AnimationSnapshot& snapshot, const std::string& fn)
+{
+	if (!isSaving()) {
+		start(snapshot, fn);
+		return;
+	}
+	waiting_ = true;
+	waiting_snapshot_ = snapshot;
+	waiting_fn_ = fn;
+}
+
+bool AnimationSaver::poll()
+{
+	if (!isSaving() || !done_)
+		return false;
+	worker_.join();
+	last_fn_ = fn_;
+	last_succeeded_ = succeeded_;
+	if (last_succeeded_)
+		std::cout << "Saved " << last_fn_ << std::endl;
+	else
+		std::cerr << "Saving " << last_fn_ << " failed" << std::endl;
+	if (waiting_) {
+		waiting_ = false;
+		start(waiting_snapshot_, waiting_fn_);
+		waiting_snapshot_ = AnimationSnapshot();
+	}
+	return true;
+}
+
+void AnimationSaver::start(const AnimationSnapshot& snapshot, const std::string& fn)
+{
+	fn_ = fn;
+	done_ = false;
+	progress_ = 0.0f;
+	worker_ = std::thread([this, snapshot, fn]() {
+		succeeded_ = writeAnimationSnapshot(snapshot, fn, &progress_);
+		done_ = true;
+	});
+}
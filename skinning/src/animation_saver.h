@@ -0,0 +1,79 @@
+#ifndef ANIMATION_SAVER_H
+#define ANIMATION_SAVER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+struct TimelineKeys;
+struct BakedClip;
+struct CompressedClip;
+
+/*
+ * Everything Mesh::saveAnimationTo writes, frozen at one point in time.
+ * The keys are shared with the timeline until it is next edited. The
+ * clips are shared with the mesh the same way: a clip is never changed
+ * once made, baking again replaces it. They are null unless current.
+ */
+struct AnimationSnapshot {
+	std::shared_ptr<const TimelineKeys> keys;
+	std::shared_ptr<const BakedClip> baked_clip;
+	std::shared_ptr<const CompressedClip> compressed_clip;
+};
+
+/*
+ * Writes a snapshot to fn, in the format its extension asks for, with the
+ * clips beside it. Every file is written under a temporary name and
+ * renamed over the old one when complete, so a reader never sees half a
+ * file. Side files from an older save are removed if the snapshot has no
+ * current clip to replace them.
+ */
+bool writeAnimationSnapshot(const AnimationSnapshot& snapshot, const std::string& fn,
+                            std::atomic<float>* progress = nullptr);
+
+/*
+ * Moves tmp over fn. rename replaces the target in one step on POSIX;
+ * Windows refuses to rename onto an existing file, so it is removed first.
+ * tmp is synced to disk before the rename and the directory after it, so
+ * once this returns true fn survives a crash or power loss.
+ */
+bool replaceFile(const std::string& tmp, const std::string& fn);
+
+/*
+ * Saves snapshots on a worker thread, one at a time. A save requested
+ * while another is running waits for it, and a later request replaces a
+ * waiting one. poll() has to be called regularly, e.g. once per frame.
+ */
+class AnimationSaver {
+public:
+	AnimationSaver() = default;
+	AnimationSaver(const AnimationSaver&) = delete;
+	AnimationSaver& operator=(const AnimationSaver&) = delete;
+	~AnimationSaver(); // Finishes the running and the waiting save
+
+	void save(const AnimationSnapshot& snapshot, const std::string& fn);
+	bool poll(); // Reports a finished save and starts the waiting one, true if one finished
+
+	bool isSaving() const { return worker_.joinable(); }
+	float progress() const { return progress_; }
+	const std::string& lastFile() const { return last_fn_; } // Of the last finished save
+	bool lastSucceeded() const { return last_succeeded_; }
+
+private:
+	void start(const AnimationSnapshot& snapshot, const std::string& fn);
+
+	std::thread worker_;
+	std::atomic<bool> done_{false};
+	std::atomic<bool> succeeded_{false};
+	std::atomic<float> progress_{0.0f};
+	std::string fn_;
+	std::string last_fn_;
+	bool last_succeeded_ = false;
+
+	bool waiting_ = false;
+	AnimationSnapshot waiting_snapshot_;
+	std::string waiting_fn_;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "baked_clip.h"
+#include "pose_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+	/*
+	 * File layout, native byte order:
+	 *      header, then world_rot as nframes * njoints (x, y, z, w),
+	 *      then world_trans as nframes * njoints (x, y, z).
+	 */
+	struct BakedClipHeader {
+		char magic[4];
+		uint32_t version;
+		int32_t njoints;
+		int32_t nframes;
+		float rate;
+		float start_time;
+		uint64_t keys_hash; // Of the TimelineKeys baked
+	};
+
+	const char kMagic[4] = { 'V', 'M', 'B', 'K' };
+	const uint32_t kVersion = 2; // 1 had no keys_hash
+}
+
+void BakedClip::clear()
+{
+	rate = 0.0f;
+	start_time = 0.0f;
+	njoints = 0;
+	nframes = 0;
+	world_rot.clear();
+	world_trans.clear();
+}
+
+void BakedClip::resize(int joints, int frames)
+{
+	njoints = joints;
+	nframes = frames;
+	world_rot.resize(size_t(joints) * frames);
+	world_trans.resize(size_t(joints) * frames);
+}
+
+void BakedClip::sample(float t, glm::fquat* rot, glm::vec3* trans) const
+{
+	float f = (t - start_time) * rate;
+	f = std::min(std::max(f, 0.0f), float(nframes - 1));
+	int row = std::min(int(f), nframes - 1);
+	int next = std::min(row + 1, nframes - 1);
+	float percent = f - row;
+	size_t a = size_t(row) * njoints;
+	size_t b = size_t(next) * njoints;
+	// Rows are 1/rate apart, close enough that nlerp matches slerp.
+	quatNlerpBatch(&world_rot[a], &world_rot[b], percent, rot, njoints);
+	for (int i = 0; i < njoints; i++)
+		trans[i] = glm::mix(world_trans[a + i], world_trans[b + i], percent);
+}
+
+bool BakedClip::saveTo(const std::string& fn, uint64_t keys_hash) const
+{
+	std::ofstream file(fn, std::ios::binary);
+	if (!file) {
+		std::cerr << "Cannot write baked clip " << fn << std::endl;
+		return false;
+	}
+	BakedClipHeader header;
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.njoints = njoints;
+	header.nframes = nframes;
+	header.rate = rate;
+	header.start_time = start_time;
+	header.keys_hash = keys_hash;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(world_rot.data()), world_rot.size() * sizeof(glm::fquat));
+	file.write(reinterpret_cast<const char*>(world_trans.data()), world_trans.size() * sizeof(glm::vec3));
+	return bool(file);
+}
+
+bool BakedClip::loadFrom(const std::string& fn, uint64_t keys_hash)
+{
+	std::ifstream file(fn, std::ios::binary);
+	if (!file)
+		return false;
+	BakedClipHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+	    header.version != kVersion || header.njoints <= 0 || header.nframes <= 0 ||
+	    !(header.rate > 0.0f)) {
+		std::cerr << fn << " is not a baked clip" << std::endl;
+		return false;
+	}
+	if (header.keys_hash != keys_hash) {
+		std::cerr << fn << " was baked from other keyframes, ignoring it" << std::endl;
+		return false;
+	}
+	resize(header.njoints, header.nframes);
+	rate = header.rate;
+	start_time = header.start_time;
+	file.read(reinterpret_cast<char*>(world_rot.data()), world_rot.size() * sizeof(glm::fquat));
+	file.read(reinterpret_cast<char*>(world_trans.data()), world_trans.size() * sizeof(glm::vec3));
+	if (!file) {
+		std::cerr << fn << " is truncated" << std::endl;
+		clear();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+#ifndef BAKED_CLIP_H
+#define BAKED_CLIP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/*
+ * An animation sampled at a fixed rate. Row f holds the world rotation
+ * and translation of every joint at start_time + f / rate, so playing
+ * it back only blends two rows; no interpolation of keyframes and no
+ * forward kinematics.
+ *
+ * revision is the Timeline::revision() the clip was baked from. Its side
+ * file records TimelineKeys::hash() of those keys instead, and loadFrom
+ * refuses a file made from other keys.
+ */
+struct BakedClip {
+	float rate = 0.0f;
+	float start_time = 0.0f;
+	int njoints = 0;
+	int nframes = 0;
+	unsigned revision = 0;
+	std::vector<glm::fquat> world_rot;   // nframes * njoints
+	std::vector<glm::vec3> world_trans;  // nframes * njoints
+
+	bool empty() const { return nframes == 0; }
+	void clear();
+	void resize(int joints, int frames);
+	glm::fquat* rotRow(int frame) { return world_rot.data() + size_t(frame) * njoints; }
+	glm::vec3* transRow(int frame) { return world_trans.data() + size_t(frame) * njoints; }
+
+	/*
+	 * Blend of the two rows around t, clamped to the clip.
+	 */
+	void sample(float t, glm::fquat* rot, glm::vec3* trans) const;
+
+	bool saveTo(const std::string& fn, uint64_t keys_hash) const;
+	bool loadFrom(const std::string& fn, uint64_t keys_hash);
+};
+
+#endif
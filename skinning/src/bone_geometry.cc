@@ -1,7 +1,14 @@
 #include "config.h"
 #include "bone_geometry.h"
 #include "texture_to_render.h"
+#include "pose_kernels.h"
+#include "model_cache.h"
+#include "texture_registry.h"
+#include <algorithm>
+#include <cmath>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <queue>
 #include <iostream>
 #include <stdexcept>
@@ -11,6 +18,47 @@
 
 namespace {
 	constexpr glm::fquat identity_quat(1.0, 0.0, 0.0, 0.0);
+
+	/*
+	 * D = D_parent * B * T, where B only translates by init_rel_position.
+	 * In terms of rotation and translation that is one quaternion product
+	 * and one rotated offset per joint, once the parent is up to date.
+	 */
+	void updateWorldTransform(Skeleton& skeleton, int id)
+	{
+		int parent = skeleton.parent[id];
+		if (parent == -1) {
+			skeleton.world_rot[id] = skeleton.local_rot[id];
+			skeleton.world_trans[id] = skeleton.init_rel_position[id] + skeleton.root_trans;
+		} else {
+			const glm::fquat& parent_rot = skeleton.world_rot[parent];
+			skeleton.world_rot[id] = parent_rot * skeleton.local_rot[id];
+			skeleton.world_trans[id] = skeleton.world_trans[parent] + parent_rot * skeleton.init_rel_position[id];
+		}
+	}
+
+	/*
+	 * Same pose as Mesh::updateAnimation(t) computes, written to any
+	 * skeleton so that several threads can sample at once.
+	 */
+	void poseAt(const Timeline& timeline, float t, int& cursor, Skeleton& skeleton)
+	{
+		int key = -1;
+		if (t <= timeline.time(0))
+			key = 0;
+		else if (t >= timeline.endTime())
+			key = timeline.size() - 1;
+		if (key != -1) {
+			const glm::fquat* rel_rot = timeline.relRot(key);
+			std::copy(rel_rot, rel_rot + skeleton.getNumberOfJoints(), skeleton.local_rot.begin());
+			skeleton.root_trans = timeline.rootTrans(key);
+		} else {
+			float percent;
+			int segment = timeline.locate(t, &percent, cursor);
+			timeline.interpolate(segment, percent, skeleton.local_rot.data(), &skeleton.root_trans);
+		}
+		skeleton.forwardKinematics();
+	}
 }
 
 /*
@@ -44,329 +92,397 @@ const glm::fquat* Skeleton::collectJointRot() const
 
 // FIXME: Implement bone animation.
 
-void Skeleton::refreshCache(Configuration* target)
+int Skeleton::addJoint(const glm::vec3& position, int parent_id)
 {
-	if (target == nullptr)
-		target = &cache;
-	target->rot.resize(joints.size());
-	target->trans.resize(joints.size());
-	for (size_t i = 0; i < joints.size(); i++) {
-		target->rot[i] = joints[i].orientation;
-		target->trans[i] = joints[i].position;
+	int id = getNumberOfJoints();
+	glm::vec3 wcoord(0.0f), parent_wcoord(0.0f);
+	if (parent_id != -1) {
+		wcoord = init_position[parent_id];
+		parent_wcoord = init_wcoord[parent_id];
 	}
+	glm::mat4 B = glm::mat4(1.0f);
+	B[3] = glm::vec4(wcoord - parent_wcoord, 1.0f);
+
+	parent.push_back(parent_id);
+	init_wcoord.push_back(wcoord);
+	init_position.push_back(position);
+	init_rel_position.push_back(wcoord - parent_wcoord);
+	U.push_back(parent_id == -1 ? B : U[parent_id] * B);
+	inverse_U.push_back(glm::inverse(U.back()));
+	local_rot.push_back(identity_quat);
+	world_rot.push_back(identity_quat);
+	world_trans.push_back(wcoord);
+	return id;
 }
 
+void Skeleton::buildTopology()
+{
+	int njoints = getNumberOfJoints();
+	child_begin.assign(njoints + 1, 0);
+	for (int id = 0; id < njoints; id++)
+		if (parent[id] != -1)
+			child_begin[parent[id] + 1]++;
+	for (int id = 0; id < njoints; id++)
+		child_begin[id + 1] += child_begin[id];
+	child_index.resize(child_begin[njoints]);
+	std::vector<int> fill(child_begin.begin(), child_begin.end() - 1);
+	for (int id = 0; id < njoints; id++)
+		if (parent[id] != -1)
+			child_index[fill[parent[id]]++] = id;
+
+	fk_order.clear();
+	fk_order.reserve(njoints);
+	fk_index.assign(njoints, -1);
+	subtree_size.assign(njoints, 1);
+	std::vector<int> stack;
+	for (int root = 0; root < njoints; root++) {
+		if (parent[root] != -1)
+			continue;
+		stack.push_back(root);
+		while (!stack.empty()) {
+			int id = stack.back();
+			stack.pop_back();
+			fk_index[id] = fk_order.size();
+			fk_order.push_back(id);
+			for (int c = child_begin[id + 1] - 1; c >= child_begin[id]; c--)
+				stack.push_back(child_index[c]);
+		}
+	}
+	// Children always come after their parent, so walk backwards to sum up.
+	for (int k = njoints - 1; k >= 0; k--) {
+		int id = fk_order[k];
+		if (parent[id] != -1)
+			subtree_size[parent[id]] += subtree_size[id];
+	}
+
+	std::vector<int> depth(njoints, 0);
+	int max_depth = 0;
+	for (int id : fk_order) {
+		if (parent[id] != -1)
+			depth[id] = depth[parent[id]] + 1;
+		max_depth = std::max(max_depth, depth[id]);
+	}
+	level_begin.assign(njoints > 0 ? max_depth + 2 : 1, 0);
+	for (int id = 0; id < njoints; id++)
+		level_begin[depth[id] + 1]++;
+	for (size_t d = 1; d < level_begin.size(); d++)
+		level_begin[d] += level_begin[d - 1];
+	level_order.resize(njoints);
+	fill.assign(level_begin.begin(), level_begin.end() - 1);
+	for (int id = 0; id < njoints; id++)
+		level_order[fill[depth[id]]++] = id;
+}
 
-Mesh::Mesh()
+void Skeleton::forwardKinematics()
 {
+	if (level_begin.size() < 2)
+		return;
+	for (int k = level_begin[0]; k < level_begin[1]; k++)
+		updateWorldTransform(*this, level_order[k]);
+	for (size_t d = 1; d + 1 < level_begin.size(); d++) {
+		composeAffineBatch(&level_order[level_begin[d]],
+		                   level_begin[d + 1] - level_begin[d],
+		                   parent.data(),
+		                   local_rot.data(), init_rel_position.data(),
+		                   world_rot.data(), world_trans.data());
+	}
+	dirty_roots.clear();
 }
 
-Mesh::~Mesh()
+void Skeleton::forwardKinematics(int root)
 {
+	int begin = fk_index[root];
+	int end = begin + subtree_size[root];
+	for (int k = begin; k < end; k++)
+		updateWorldTransform(*this, fk_order[k]);
 }
 
-Keyframe* Mesh::getLastKeyFrame()
+void Skeleton::markDirty(int id)
 {
-	Keyframe* keyframe = keyframes[keyframes.size() - 1];
-	return keyframe;
+	if (std::find(dirty_roots.begin(), dirty_roots.end(), id) == dirty_roots.end())
+		dirty_roots.push_back(id);
 }
 
-void Mesh::addKeyframe()
+void Skeleton::updateDirty()
 {
-	Keyframe* newKeyframe = new Keyframe();
-	keyframes.push_back(newKeyframe);
-	Keyframe* keyframe = keyframes[keyframes.size()-1];
-	keyframe->U.clear();
-	keyframe->T.clear();
-	keyframe->D.clear();
-	keyframe->orientation.clear();
-	keyframe->rel_orientation.clear();
-	updateAllMatrices();
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		keyframe->U.push_back(curr_joint->U);
-		keyframe->T.push_back(curr_joint->T);
-		keyframe->D.push_back(curr_joint->D);
-		keyframe->orientation.push_back(curr_joint->orientation);
-		keyframe->rel_orientation.push_back(curr_joint->rel_orientation);
+	if (dirty_roots.empty())
+		return;
+	std::sort(dirty_roots.begin(), dirty_roots.end(),
+		[this](int a, int b) { return fk_index[a] < fk_index[b]; });
+	// Subtrees are either nested or disjoint, so a dirty joint that falls
+	// inside an earlier range has already been refreshed with it.
+	int covered = 0;
+	for (int root : dirty_roots) {
+		int begin = fk_index[root];
+		if (begin < covered)
+			continue;
+		forwardKinematics(root);
+		covered = begin + subtree_size[root];
 	}
+	dirty_roots.clear();
 }
 
-void Mesh::updateKeyframe(int keyframeid)
+void Skeleton::updateLocalFromWorld()
 {
-	Keyframe* keyframe = keyframes[keyframeid];
-	keyframe->U.clear();
-	keyframe->T.clear();
-	keyframe->D.clear();
-	keyframe->orientation.clear();
-	keyframe->rel_orientation.clear();
-	updateAllMatrices();
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		keyframe->U.push_back(curr_joint->U);
-		keyframe->T.push_back(curr_joint->T);
-		keyframe->D.push_back(curr_joint->D);
-		keyframe->orientation.push_back(curr_joint->orientation);
-		keyframe->rel_orientation.push_back(curr_joint->rel_orientation);
+	bool first_root = true;
+	for (int id : fk_order) {
+		int p = parent[id];
+		if (p == -1) {
+			local_rot[id] = world_rot[id];
+			if (first_root)
+				root_trans = world_trans[id] - init_rel_position[id];
+			first_root = false;
+		} else {
+			local_rot[id] = glm::conjugate(world_rot[p]) * world_rot[id];
+		}
 	}
+	dirty_roots.clear();
 }
 
-void Mesh::deleteKeyframe(int keyframeid)
+glm::mat4 Skeleton::worldMatrix(int id) const
 {
-	Keyframe* keyframe = keyframes[keyframeid];
-	keyframes.erase(keyframes.begin()+keyframeid, keyframes.begin()+keyframeid+1);
-	keyframe->U.clear();
-	keyframe->T.clear();
-	keyframe->D.clear();
-	keyframe->orientation.clear();
-	keyframe->rel_orientation.clear();
-	keyframe->texture.~TextureToRender();
-	free(keyframe);
+	glm::mat4 D = glm::mat4_cast(world_rot[id]);
+	D[3] = glm::vec4(world_trans[id], 1.0f);
+	return D;
 }
 
-void Mesh::setPoseFromKeyframe(int keyframeid)
+void Skeleton::refreshCache(Configuration* target)
 {
-	if (keyframes.size() == 0) {
-		return;
-	}
-	Keyframe* keyframe = keyframes[keyframeid];
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		glm::mat4 curr_T = keyframe->T[i];
-		glm::mat4 curr_U = keyframe->U[i];
-		glm::mat4 curr_D = keyframe->D[i];
-		glm::fquat curr_orientation = keyframe->orientation[i];
-		glm::fquat rel_orientation = keyframe->rel_orientation[i];
-		curr_joint->U = curr_U;
-		curr_joint->T = curr_T;
-		curr_joint->D = curr_D;
-		curr_joint->orientation = curr_orientation;
-		curr_joint->rel_orientation = rel_orientation;
-	}
-	updateAllPositionsAndRotations();
+	if (target == nullptr)
+		target = &cache;
+	int njoints = getNumberOfJoints();
+	target->rot.resize(njoints);
+	target->trans.resize(njoints);
+	target->palette.resize(njoints);
+	quatToAffineBatch(world_rot.data(), world_trans.data(), target->palette.data(), njoints);
+	mat4MultiplyBatch(target->palette.data(), inverse_U.data(), target->palette.data(), njoints);
+	std::copy(world_rot.begin(), world_rot.end(), target->rot.begin());
+	for (int i = 0; i < njoints; i++)
+		target->trans[i] = glm::vec3(target->palette[i] * glm::vec4(init_position[i], 1.0f));
 }
 
-void Mesh::setInterpolation(int keyframeid, float percent)
+
+Mesh::Mesh()
 {
-	//MAYBE: NEED TO DO THIS METHOD STILL
-	Keyframe* curr_keyframe = keyframes[keyframeid];
-	Keyframe* next_keyframe = keyframes[keyframeid + 1];
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		glm::mat4 curr_T = curr_keyframe->T[i];
-		glm::mat4 curr_U = curr_keyframe->U[i];
-		glm::mat4 curr_D = curr_keyframe->D[i];
-
-		glm::mat4 next_T = next_keyframe->T[i];
-		glm::mat4 next_U = next_keyframe->U[i];
-		glm::mat4 next_D = next_keyframe->D[i];
-
-		glm::mat4 curr_mat = curr_D * glm::inverse(curr_U);
-		glm::mat4 next_mat = next_D * glm::inverse(next_U);
-		
-		glm::mat4 extract_translation = glm::mat4(0.0f);
-		glm::vec4 curr_trans, next_trans;
-
-		extract_translation = glm::mat4(0.0f);
-		extract_translation[3] = -((curr_mat)[3]);
-		curr_trans = -extract_translation[3];
-		extract_translation[3][3] = 0;
-		glm::fquat curr_orientation = glm::quat_cast(curr_mat + extract_translation);
-
-		extract_translation = glm::mat4(0.0f);
-		extract_translation[3] = -((next_mat)[3]);
-		next_trans = -extract_translation[3];
-		extract_translation[3][3] = 0;
-		glm::fquat next_orientation = glm::quat_cast(next_mat + extract_translation);
-
-		//glm::vec4 trans = glm::mix(curr_trans, next_trans, percent);
-
-		glm::fquat set_orientation = glm::mix(curr_orientation, next_orientation, percent);
-		//glm::mat4 mat = glm::toMat4(set_orientation);
-		//mat[3] = trans;
-
-		glm::fquat curr_rel_orientation = curr_keyframe->rel_orientation[i];
-		glm::fquat next_rel_orientation = next_keyframe->rel_orientation[i];
-		glm::fquat set_rel_orientation = glm::mix(curr_rel_orientation, next_rel_orientation, percent);
-		curr_joint->rel_orientation = set_rel_orientation;
-		curr_joint->orientation = set_orientation;
-	}
-	setTFromRelOrientation();
-	updateAllPositionsAndRotations();
 }
 
-void Mesh::setTFromRelOrientation()
+Mesh::~Mesh()
 {
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		curr_joint->T = glm::toMat4(curr_joint->rel_orientation);
-	}
-	updateAllMatrices();
 }
 
-void Mesh::updateAllMatrices()
+Timeline::Handle Mesh::addKeyframe()
 {
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		curr_joint->D = calculateD(i);
-	}
-	//updateAllRotations();
+	skeleton.updateDirty();
+	Timeline::Handle handle = timeline.append(skeleton.local_rot.data(), skeleton.root_trans);
+	journal.recordInsert(timeline, timeline.size() - 1);
+	return handle;
 }
 
-void Mesh::updateAllPositionsAndRotations()
+void Mesh::updateKeyframe(int keyframeid)
 {
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
+	skeleton.updateDirty();
+	timeline.set(keyframeid, skeleton.local_rot.data(), skeleton.root_trans);
+	journal.recordSet(timeline, keyframeid);
+}
 
-		curr_joint->position = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_position, 1));
-		curr_joint->wcoord = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_wcoord, 1));
+void Mesh::deleteKeyframe(int keyframeid)
+{
+	// Close the gap so the keyframes after it keep their spacing.
+	float gap = 0.0f;
+	if (keyframeid + 1 < timeline.size())
+		gap = timeline.duration(keyframeid);
+	timeline.erase(keyframeid);
+	timeline.shiftTimes(keyframeid, -gap);
+	journal.recordErase(keyframeid, 1);
+	journal.recordShiftTimes(keyframeid, -gap);
+}
 
-		glm::mat4 extract_translation = glm::mat4(0.0f);
-		extract_translation[3] = -((curr_joint->D * glm::inverse(curr_joint->U))[3]);
-		extract_translation[3][3] = 0;
-		curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);
+void Mesh::setPoseFromKeyframe(int keyframeid)
+{
+	if (timeline.empty()) {
+		return;
 	}
+	const glm::fquat* rel_rot = timeline.relRot(keyframeid);
+	std::copy(rel_rot, rel_rot + skeleton.getNumberOfJoints(), skeleton.local_rot.begin());
+	skeleton.root_trans = timeline.rootTrans(keyframeid);
+	skeleton.forwardKinematics();
 }
 
-void Mesh::updateAllRotations()
+void Mesh::setInterpolation(int keyframeid, float percent)
 {
-	return;
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		curr_joint->D = calculateD(i);
-	}
+	timeline.interpolate(keyframeid, percent, skeleton.local_rot.data(), &skeleton.root_trans);
+	skeleton.forwardKinematics();
 }
 
-void Mesh::loadDefaults()
+void Mesh::bake(float rate)
 {
-	for (int i = 0; (unsigned)i < skeleton.joints.size(); i++) {
-		Joint* curr_joint = &(skeleton.joints[i]);
-		curr_joint->T = glm::mat4(1.0f);
-		curr_joint->orientation = glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
-		curr_joint->rel_orientation = glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
-
-		/*curr_joint->position = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_position, 1));
-		curr_joint->wcoord = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_wcoord, 1));
-
-		glm::mat4 extract_translation = glm::mat4(0.0f);
-		extract_translation[3] = -((curr_joint->D * glm::inverse(curr_joint->U))[3]);
-		extract_translation[3][3] = 0;
-		curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);*/
+	baked_clip.reset();
+	if (timeline.empty() || !(rate > 0.0f))
+		return;
+	float start = timeline.time(0);
+	int nframes = int(std::ceil((timeline.endTime() - start) * rate)) + 1;
+	int njoints = skeleton.getNumberOfJoints();
+	auto clip = std::make_shared<BakedClip>();
+	clip->resize(njoints, nframes);
+	clip->rate = rate;
+	clip->start_time = start;
+	clip->revision = timeline.revision();
+
+	timeline.prepare();
+	#pragma omp parallel
+	{
+		Skeleton pose = skeleton; // every thread runs FK on its own copy
+		int cursor = 0;
+		#pragma omp for schedule(static)
+		for (int f = 0; f < nframes; f++) {
+			poseAt(timeline, start + f / rate, cursor, pose);
+			std::copy(pose.world_rot.begin(), pose.world_rot.end(), clip->rotRow(f));
+			std::copy(pose.world_trans.begin(), pose.world_trans.end(), clip->transRow(f));
+		}
 	}
-	updateAllMatrices();
-	updateAllPositionsAndRotations();
+	baked_clip = std::move(clip);
 }
 
-glm::mat4 Mesh::calculateU(int id)
+bool Mesh::isBakeCurrent() const
 {
-	Joint* curr_joint = &skeleton.joints[id];
-	if (curr_joint->parent_index == -1) {
-		glm::mat4 B = glm::mat4(1.0f);
-		B[3] = glm::vec4(curr_joint->init_wcoord, 1) - glm::vec4(0, 0, 0, 0);
-		return B * glm::mat4(1.0f);
-	}
-	else {
-		glm::mat4 parentU = skeleton.joints[curr_joint->parent_index].U;
-		glm::mat4 B = glm::mat4(1.0f);
-		B[3] = glm::vec4(curr_joint->init_wcoord, 1) - glm::vec4(skeleton.joints[curr_joint->parent_index].init_wcoord, 0);
-		skeleton.joints[id].init_rel_position = glm::vec3(B[3]);
-		return parentU * B;
-	}
+	return baked_clip && !baked_clip->empty() &&
+	       baked_clip->revision == timeline.revision() &&
+	       baked_clip->njoints == skeleton.getNumberOfJoints();
 }
 
-glm::mat4 Mesh::calculateD(int id)
+void Mesh::compressAnimation(const CompressionBudget& budget)
 {
-	Joint* curr_joint = &skeleton.joints[id];
-	Joint* parent_joint;
-	if (curr_joint->parent_index == -1) {
-		glm::mat4 B = glm::mat4(1.0f);
-		B[3] = glm::vec4(curr_joint->init_wcoord, 1) - glm::vec4(0, 0, 0, 0);
-		return B * curr_joint->T;
-	}
-	else {
-		parent_joint = &skeleton.joints[curr_joint->parent_index];
-		glm::mat4 B = glm::mat4(1.0f);
-		B[3] = glm::vec4(curr_joint->init_wcoord, 1) - glm::vec4(parent_joint->init_wcoord, 0);
-		//return calculateD(curr_joint->parent_index) * B * glm::toMat4(curr_joint->orientation);
-		return calculateD(curr_joint->parent_index) * B * curr_joint->total_roll * curr_joint->T;
-	}
+	auto clip = std::make_shared<CompressedClip>();
+	clip->encode(timeline, budget);
+	compressed_clip = std::move(clip);
+}
+
+bool Mesh::isCompressedCurrent() const
+{
+	return compressed_clip && !compressed_clip->empty() &&
+	       compressed_clip->revision == timeline.revision() &&
+	       compressed_clip->njoints == skeleton.getNumberOfJoints();
+}
+
+void Mesh::loadDefaults()
+{
+	std::fill(skeleton.local_rot.begin(), skeleton.local_rot.end(), identity_quat);
+	skeleton.root_trans = glm::vec3(0.0f);
+	skeleton.forwardKinematics();
 }
 
 void Mesh::loadPmd(const std::string& fn)
 {
+	if (loadModelCache(fn, *this)) {
+		timeline.reset(skeleton.getNumberOfJoints());
+		return;
+	}
 	MMDReader mr;
-	mr.open(fn);
-	mr.getMesh(vertices, faces, vertex_normals, uv_coordinates);
-	computeBounds();
-	mr.getMaterial(materials);
-
-	// FIXME: load skeleton and blend weights from PMD file,
-	//        initialize std::vectors for the vertex attributes,
-	//        also initialize the skeleton as needed
-	glm::vec3 wcoord;
-	int parent;
-
-	int curr_id = 0;
-	skeleton.joints.clear();
-	while (mr.getJoint(curr_id, wcoord, parent)) {
-		Joint curr_joint;
-		if (parent == -1) {
-			curr_joint = Joint(curr_id, wcoord, parent);
-			curr_joint.wcoord = glm::vec3(0, 0, 0);
-			curr_joint.init_wcoord = curr_joint.wcoord;
-			//std::cerr << glm::to_string(curr_joint.wcoord) << " " << glm::to_string(wcoord) << std::endl;
-		}
-		else
-		{
-			curr_joint = Joint(curr_id, wcoord, parent);
-			curr_joint.wcoord = skeleton.joints[parent].position;
-			curr_joint.init_wcoord = curr_joint.wcoord;
-			//std::cerr << glm::to_string(curr_joint.wcoord) << " " << glm::to_string(wcoord) << std::endl;
+	bool opened = mr.open(fn);
+	std::vector<std::string> texture_files;
+	mr.getMaterial(materials, &texture_files);
+	std::vector<std::string> textures; // Each file once
+	std::map<std::string, int> texture_index;
+	for (const auto& texfn : texture_files)
+		if (!texfn.empty() && texture_index.emplace(texfn, int(textures.size())).second)
+			textures.push_back(texfn);
+	std::vector<std::shared_ptr<Image>> images(textures.size());
+
+	// Once the PMD is parsed, converting the mesh, building the skeleton,
+	// collecting the blend weights and decoding every texture only read
+	// it, so they run as independent jobs on the OpenMP team, largest
+	// first. Unpacking the weights needs the first three. Textures some
+	// other model already uses are not decoded again.
+	std::vector<SparseTuple> jointWeights;
+	std::vector<std::function<void()>> jobs;
+	jobs.emplace_back([&]() {
+		mr.getMesh(vertices, faces, vertex_normals, uv_coordinates);
+		computeBounds();
+	});
+	jobs.emplace_back([&]() { mr.getJointWeights(jointWeights); });
+	jobs.emplace_back([&]() {
+		glm::vec3 wcoord;
+		int parent;
+		int curr_id = 0;
+		skeleton = Skeleton();
+		while (mr.getJoint(curr_id, wcoord, parent)) {
+			skeleton.addJoint(wcoord, parent);
+			curr_id++;
 		}
-		//curr_joint = Joint(curr_id, wcoord, parent);
-		curr_joint.T = glm::mat4(1.0f);
-		curr_joint.total_roll = glm::mat4(1.0f);
-		//curr_joint.passed_up_T = glm::mat4(1.0f);
-		curr_joint.children.clear();
-		skeleton.joints.push_back(curr_joint);
-		Joint* curr = &skeleton.joints[skeleton.joints.size() - 1];
-		curr->U = calculateU(curr_id);
-		curr->D = calculateD(curr_id);
-		//curr->skinning_U = calculateSkinningU(curr_id);
-		//curr->skinning_D = calculateSkinningD(curr_id);
-		//curr->skinning_T = glm::mat4(1.0f);
-		curr->orientation = glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
-		curr->rel_orientation = glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
-		curr->is_root = parent == -1;
-		if (curr->parent_index != -1) {
-			skeleton.joints[skeleton.joints[skeleton.joints.size() - 1].parent_index].children.push_back(curr_id);
+		skeleton.buildTopology();
+		skeleton.forwardKinematics();
+		mr.getJointNames(joint_names);
+	});
+	for (size_t t = 0; t < textures.size(); t++)
+		jobs.emplace_back([&, t]() { images[t] = TextureRegistry::instance().load(textures[t]); });
+	std::exception_ptr error;
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int j = 0; j < int(jobs.size()); j++) {
+		try {
+			jobs[j]();
+		} catch (...) {
+			#pragma omp critical
+			if (!error)
+				error = std::current_exception();
 		}
-		curr_id++;
 	}
-	std::vector<SparseTuple> jointWeights;
-	jointWeights.clear();
-	mr.getJointWeights(jointWeights);
-	for (auto tuple : jointWeights)
-	{
-		joint0.push_back(tuple.jid0);
-		joint1.push_back(tuple.jid1);
-		weight_for_joint0.push_back(tuple.weight0);
-		int parent0 = skeleton.joints[tuple.jid0].parent_index;
-		Joint* parent_0 = &skeleton.joints[parent0];
-		vector_from_joint0.push_back(glm::vec3(vertices[tuple.vid]) - skeleton.joints[tuple.jid0].init_position);
-		if (tuple.jid1 >= 0) {
-			vector_from_joint1.push_back(glm::vec3(vertices[tuple.vid]) - skeleton.joints[tuple.jid1].init_position);
-		}
+	if (error)
+		std::rethrow_exception(error);
+
+	for (size_t i = 0; i < materials.size(); i++)
+		if (!texture_files[i].empty())
+			materials[i].texture = images[texture_index[texture_files[i]]];
+	timeline.reset(skeleton.getNumberOfJoints());
+
+	int ntuples = int(jointWeights.size());
+	joint0.resize(ntuples);
+	joint1.resize(ntuples);
+	weight_for_joint0.resize(ntuples);
+	vector_from_joint0.resize(ntuples);
+	vector_from_joint1.resize(ntuples);
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < ntuples; i++) {
+		const SparseTuple& tuple = jointWeights[i];
+		glm::vec3 position(vertices[tuple.vid]);
+		joint0[i] = tuple.jid0;
+		joint1[i] = tuple.jid1;
+		weight_for_joint0[i] = tuple.weight0;
+		vector_from_joint0[i] = position - skeleton.init_position[tuple.jid0];
+		if (tuple.jid1 >= 0)
+			vector_from_joint1[i] = position - skeleton.init_position[tuple.jid1];
 		else
-		{
-			vector_from_joint1.push_back(glm::vec3(vertices[tuple.vid]));
-		}
+			vector_from_joint1[i] = position;
+	}
+	if (opened)
+		saveModelCache(fn, *this, texture_files);
+}
+
+bool Mesh::importMotion(const std::string& fn)
+{
+	std::vector<glm::fquat> rel_rot;
+	std::vector<glm::vec3> root_trans;
+	int nframes = 0;
+	if (!MMDReader::getMotion(fn, joint_names, rel_rot, root_trans, nframes))
+		return false;
+	if (rel_rot.size() != size_t(nframes) * skeleton.getNumberOfJoints()) {
+		std::cerr << fn << " does not match the skeleton" << std::endl;
+		return false;
 	}
+	std::vector<float> times(nframes);
+	for (int i = 0; i < nframes; i++)
+		times[i] = i / 30.0f; // VMD frames
+	// The keyframes are not from a file of ours, so there is nothing to
+	// journal next to.
+	journal.detach();
+	timeline.reset(skeleton.getNumberOfJoints());
+	timeline.insert(0, nframes, rel_rot.data(), root_trans.data(), times.data());
+	std::cerr << "Imported " << nframes << " frames from " << fn << std::endl;
+	return true;
 }
 
 int Mesh::getNumberOfBones() const
 {
-	return skeleton.joints.size();
+	return skeleton.getNumberOfJoints();
 }
 
 void Mesh::computeBounds()
@@ -381,24 +497,33 @@ void Mesh::computeBounds()
 
 void Mesh::updateAnimation(float t)
 {
+	skeleton.updateDirty();
 	skeleton.refreshCache(&currentQ_);
 	if (t == -1.0f) {
 		return;
 	}
 	// FIXME: Support Animation Here
-	if (keyframes.size() == 0) {
+	if (timeline.empty()) {
 		return;
 	}
-	if (t <= 0 && keyframes.size() >= 1) {
+	if (isBakeCurrent()) {
+		baked_clip->sample(t, skeleton.world_rot.data(), skeleton.world_trans.data());
+		skeleton.updateLocalFromWorld();
+	}
+	else if (isCompressedCurrent()) {
+		compressed_clip->sample(t, skeleton.local_rot.data(), &skeleton.root_trans);
+		skeleton.forwardKinematics();
+	}
+	else if (t <= timeline.time(0)) {
 		setPoseFromKeyframe(0);
 	}
-	else if (t > keyframes.size()-1 && t > 0) {
-		setPoseFromKeyframe(keyframes.size()-1);
+	else if (t >= timeline.endTime()) {
+		setPoseFromKeyframe(timeline.size()-1);
 	}
 	else {
-		int frame = (int)t;
-		float percent = t - frame;
-		setInterpolation(frame, percent);
+		float percent;
+		int segment = timeline.locate(t, &percent);
+		setInterpolation(segment, percent);
 	}
 	skeleton.refreshCache(&currentQ_);
 }
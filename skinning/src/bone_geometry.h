@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 #include <limits>
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -12,6 +13,11 @@
 
 #include <glm/gtx/string_cast.hpp>
 #include "texture_to_render.h"
+#include "timeline.h"
+#include "baked_clip.h"
+#include "compressed_clip.h"
+#include "animation_saver.h"
+#include "animation_journal.h"
 
 class TextureToRender;
 
@@ -23,84 +29,90 @@ struct BoundingBox {
 	glm::vec3 max;
 };
 
-struct Joint {
-	Joint()
-		: joint_index(-1),
-		  parent_index(-1),
-		  position(glm::vec3(0.0f)),
-		  init_position(glm::vec3(0.0f))
-	{
-	}
-	Joint(int id, glm::vec3 wcoord, int parent)
-		: joint_index(id),
-		  parent_index(parent),
-		  position(wcoord),
-		  init_position(wcoord),
-		  init_rel_position(init_position)
-	{
-	}
-
-	int joint_index;
-	int parent_index;
-	glm::vec3 wcoord;	//beginning of joint
-	glm::vec3 init_wcoord;
-	glm::vec3 position;             // position of the joint - actually the end of the joint
-	glm::fquat orientation = glm::fquat(1.0, 0.0, 0.0, 0.0);         // rotation w.r.t. initial configuration
-	glm::fquat rel_orientation = glm::fquat(1.0, 0.0, 0.0, 0.0); // rotation w.r.t. it's parent. Used for animation.
-	glm::vec3 init_position;        // initial position of this joint
-	glm::vec3 init_rel_position;    // initial relative position to its parent
-	std::vector<int> children;
-	bool is_root;
-
-	glm::mat4 T;
-	glm::mat4 D;
-	glm::mat4 U;
-	glm::mat4 total_roll;
-};
-
 struct Configuration {
 	std::vector<glm::vec3> trans;
 	std::vector<glm::fquat> rot;
+	std::vector<glm::mat4> palette; // D * U^-1 for each joint, uploaded as is for skinning
 
 	const auto& transData() const { return trans; }
 	const auto& rotData() const { return rot; }
+	const auto& paletteData() const { return palette; }
 };
 
-//struct KeyFrame {
-//	std::vector<glm::fquat> rel_rot;
-//
-//	static void interpolate(const KeyFrame& from,
-//	                        const KeyFrame& to,
-//	                        float tau,
-//	                        KeyFrame& target);
-//};
-
 struct LineMesh {
 	std::vector<glm::vec4> vertices;
 	std::vector<glm::uvec2> indices;
 };
 
+/*
+ * Joints are stored as parallel arrays indexed by joint id.
+ * Topology and rest pose are written once by Mesh::loadPmd and stay
+ * read-only afterwards. Only the pose arrays change from frame to frame.
+ */
 struct Skeleton {
-	std::vector<Joint> joints;
+	/*
+	 * Topology. The children of joint i are
+	 * child_index[child_begin[i], child_begin[i + 1]).
+	 *
+	 * fk_order lists joint ids in depth-first pre-order, so every parent
+	 * comes before its children and the subtree of joint i occupies
+	 * fk_order[fk_index[i], fk_index[i] + subtree_size[i]).
+	 *
+	 * level_order lists joint ids by depth, the joints at depth d are
+	 * level_order[level_begin[d], level_begin[d + 1]). The full FK pass
+	 * runs one level at a time so joints of a level can be batched.
+	 */
+	std::vector<int> parent;
+	std::vector<int> child_begin;
+	std::vector<int> child_index;
+	std::vector<int> fk_order;
+	std::vector<int> fk_index;
+	std::vector<int> subtree_size;
+	std::vector<int> level_order;
+	std::vector<int> level_begin;
 
-	Configuration cache;
+	/*
+	 * Rest pose.
+	 */
+	std::vector<glm::vec3> init_wcoord;       // beginning of joint
+	std::vector<glm::vec3> init_position;     // end of joint
+	std::vector<glm::vec3> init_rel_position; // init_wcoord relative to the parent's
+	std::vector<glm::mat4> U;
+	std::vector<glm::mat4> inverse_U; // inverse bind matrices, computed once in addJoint
 
-	void refreshCache(Configuration* cache = nullptr);
-	const glm::vec3* collectJointTrans() const;
-	const glm::fquat* collectJointRot() const;
+	/*
+	 * Pose.
+	 */
+	std::vector<glm::fquat> local_rot; // rotation w.r.t. its parent, used for animation
+	std::vector<glm::fquat> world_rot; // rotation w.r.t. initial configuration
+	std::vector<glm::vec3> world_trans; // beginning of joint, i.e. translation of D
+	glm::vec3 root_trans = glm::vec3(0.0f); // added to the position of every root joint
 
-	// FIXME: create skeleton and bone data structures
-};
+	/*
+	 * Joints whose local_rot changed since the last update. Edits only
+	 * mark their subtree here, and updateDirty() refreshes all of them at
+	 * most once per frame no matter how many edits came in.
+	 */
+	std::vector<int> dirty_roots;
 
-struct Keyframe {
-	std::vector<glm::mat4> T;
-	std::vector<glm::mat4> D;
-	std::vector<glm::mat4> U;
+	Configuration cache;
+
+	int addJoint(const glm::vec3& position, int parent_id); // call buildTopology() afterwards
+	void buildTopology();
+	void forwardKinematics();         // Recompute world_rot/world_trans for every joint
+	void forwardKinematics(int root); // Same for the subtree of root, parent must be current
+	void markDirty(int id);
+	void updateDirty();
+	void updateLocalFromWorld(); // Derive local_rot/root_trans after world_rot/world_trans were set directly
 
-	std::vector<glm::fquat> orientation;
-	std::vector<glm::fquat> rel_orientation;
+	int getNumberOfJoints() const { return int(parent.size()); }
+	glm::vec3 jointBegin(int id) const { return world_trans[id]; }
+	glm::vec3 jointEnd(int id) const { return world_trans[id] + world_rot[id] * (init_position[id] - init_wcoord[id]); }
+	glm::mat4 worldMatrix(int id) const; // D
 
-	TextureToRender texture;
+	void refreshCache(Configuration* cache = nullptr);
+	const glm::vec3* collectJointTrans() const;
+	const glm::fquat* collectJointRot() const;
 };
 
 struct Mesh {
@@ -123,31 +135,59 @@ struct Mesh {
 	std::vector<Material> materials;
 	BoundingBox bounds;
 	Skeleton skeleton;
+	std::vector<std::wstring> joint_names; // Motions are bound to joints by name
 
-	void loadPmd(const std::string& fn);
+	void loadPmd(const std::string& fn); // Through its model cache once there is one
 	int getNumberOfBones() const;
 	glm::vec3 getCenter() const { return 0.5f * glm::vec3(bounds.min + bounds.max); }
 	const Configuration* getCurrentQ() const; // Configuration is abbreviated as Q
 	void updateAnimation(float t = -1.0);
 
 	void saveAnimationTo(const std::string& fn);
-	void loadAnimationFrom(const std::string& fn);
+	void loadAnimationFrom(const std::string& fn); // Imports .vmd motions
+	/*
+	 * Replaces the timeline with a VMD motion of the loaded model, one
+	 * keyframe per VMD frame. reduceKeyframes thins it out.
+	 */
+	bool importMotion(const std::string& fn);
+	AnimationSnapshot snapshotAnimation() const; // For saving on another thread
 
-	glm::mat4 calculateU(int id);
-	glm::mat4 calculateD(int id);
+	/*
+	 * Edits to the timeline through Mesh are journaled next to the file
+	 * the animation was last loaded from or saved to.
+	 */
+	AnimationJournal journal;
 
-	void updateAllMatrices();
-	void updateAllRotations();
 
-	std::vector<Keyframe*> keyframes;
-	void addKeyframe();
+	Timeline timeline;
+	Timeline::Handle addKeyframe();
 	void updateKeyframe(int keyframeid);
 	void deleteKeyframe(int keyframeid);
 	void setInterpolation(int keyframeid, float percent);
 	void setPoseFromKeyframe(int keyframeid);
-	void updateAllPositionsAndRotations();
-	void setTFromRelOrientation();
-	Keyframe* getLastKeyFrame();
+
+	/*
+	 * Samples the timeline rate times per second. While the clip matches
+	 * the timeline, updateAnimation plays the clip instead. A clip is never
+	 * changed once made, so saving shares it rather than copying it.
+	 */
+	std::shared_ptr<const BakedClip> baked_clip;
+	void bake(float rate);
+	bool isBakeCurrent() const;
+
+	/*
+	 * Quantized copy of the timeline. While it matches the timeline and
+	 * no bake does, updateAnimation decodes from it instead.
+	 */
+	std::shared_ptr<const CompressedClip> compressed_clip;
+	void compressAnimation(const CompressionBudget& budget = CompressionBudget());
+	bool isCompressedCurrent() const;
+
+	/*
+	 * Drops keyframes that interpolating their neighbours reproduces to
+	 * within max_error joint displacement. Returns how many were dropped.
+	 */
+	int reduceKeyframes(float max_error);
 
 	void loadDefaults();
 
@@ -0,0 +1,336 @@
+#include "compressed_clip.h"
+#include "timeline.h"
+#include "pose_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace {
+	// The three smallest components of a unit quaternion lie in this range.
+	const float kComponentRange = 0.70710678f;
+	const int kMinRotBits = 4, kMaxRotBits = 20;
+	const int kMinTransBits = 4, kMaxTransBits = 24;
+
+	struct CompressedClipHeader {
+		char magic[4];
+		uint32_t version;
+		int32_t njoints;
+		int32_t nkeys;
+		int32_t rot_bits;
+		int32_t trans_bits;
+		float trans_min[3];
+		float trans_step[3];
+		float max_angle_error;
+		float max_trans_error;
+		uint64_t keys_hash; // Of the TimelineKeys encoded
+	};
+
+	const char kMagic[4] = { 'V', 'M', 'C', 'C' };
+	const uint32_t kVersion = 2; // 1 had no keys_hash
+
+	void writeBits(std::vector<uint64_t>& words, size_t pos, uint32_t value, int nbits)
+	{
+		size_t word = pos / 64;
+		int shift = int(pos % 64);
+		words[word] |= uint64_t(value) << shift;
+		if (shift + nbits > 64)
+			words[word + 1] |= uint64_t(value) >> (64 - shift);
+	}
+
+	uint32_t readBits(const std::vector<uint64_t>& words, size_t pos, int nbits)
+	{
+		size_t word = pos / 64;
+		int shift = int(pos % 64);
+		uint64_t value = words[word] >> shift;
+		if (shift + nbits > 64)
+			value |= words[word + 1] << (64 - shift);
+		return uint32_t(value & ((uint64_t(1) << nbits) - 1));
+	}
+
+	uint32_t quantize(float value, float lo, float step, int nbits)
+	{
+		if (step <= 0.0f)
+			return 0;
+		float q = std::round((value - lo) / step);
+		float top = float((uint64_t(1) << nbits) - 1);
+		return uint32_t(std::min(std::max(q, 0.0f), top));
+	}
+
+	float componentStep(int nbits)
+	{
+		return 2.0f * kComponentRange / float((uint64_t(1) << nbits) - 1);
+	}
+
+	/*
+	 * The largest component of q is made positive and dropped, the other
+	 * three are returned quantized in x, y, z order.
+	 */
+	int smallestThree(const glm::fquat& q, int nbits, uint32_t out[3])
+	{
+		float c[4] = { q.x, q.y, q.z, q.w };
+		int largest = 0;
+		for (int i = 1; i < 4; i++)
+			if (std::fabs(c[i]) > std::fabs(c[largest]))
+				largest = i;
+		float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+		float step = componentStep(nbits);
+		for (int i = 0, j = 0; i < 4; i++)
+			if (i != largest)
+				out[j++] = quantize(c[i] * sign, -kComponentRange, step, nbits);
+		return largest;
+	}
+
+	glm::fquat fromSmallestThree(int largest, const uint32_t in[3], int nbits)
+	{
+		float step = componentStep(nbits);
+		float c[4];
+		float sum = 0.0f;
+		for (int i = 0, j = 0; i < 4; i++) {
+			if (i == largest)
+				continue;
+			c[i] = -kComponentRange + step * in[j++];
+			sum += c[i] * c[i];
+		}
+		c[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+		return glm::normalize(glm::fquat(c[3], c[0], c[1], c[2]));
+	}
+
+	// Rotation angle between two unit quaternions, accurate for tiny angles.
+	float angleDegrees(const glm::fquat& a, const glm::fquat& b)
+	{
+		double s = (glm::dot(a, b) < 0.0f) ? -1.0 : 1.0;
+		double d2 = 0.0, s2 = 0.0;
+		for (int i = 0; i < 4; i++) {
+			double diff = double(a[i]) - s * b[i];
+			double sum = double(a[i]) + s * b[i];
+			d2 += diff * diff;
+			s2 += sum * sum;
+		}
+		return float(4.0 * std::atan2(std::sqrt(d2), std::sqrt(s2)) * 180.0 / M_PI);
+	}
+}
+
+void CompressedClip::clear()
+{
+	njoints = 0;
+	nkeys = 0;
+	rot_bits = 0;
+	trans_bits = 0;
+	time.clear();
+	bits.clear();
+	max_angle_error = 0.0f;
+	max_trans_error = 0.0f;
+	cursor_ = 0;
+	decoded_segment_ = -1;
+}
+
+void CompressedClip::encode(const Timeline& timeline, const CompressionBudget& budget)
+{
+	clear();
+	if (timeline.empty())
+		return;
+	njoints = timeline.getNumberOfJoints();
+	nkeys = timeline.size();
+	revision = timeline.revision();
+	time.resize(nkeys);
+	for (int k = 0; k < nkeys; k++)
+		time[k] = timeline.time(k);
+
+	/* Fewest rotation bits whose round trip stays within the budget */
+	for (rot_bits = kMinRotBits; rot_bits <= kMaxRotBits; rot_bits++) {
+		max_angle_error = 0.0f;
+		for (int k = 0; k < nkeys; k++) {
+			const glm::fquat* rel_rot = timeline.relRot(k);
+			for (int i = 0; i < njoints; i++) {
+				uint32_t q[3];
+				int largest = smallestThree(rel_rot[i], rot_bits, q);
+				glm::fquat decoded = fromSmallestThree(largest, q, rot_bits);
+				max_angle_error = std::max(max_angle_error, angleDegrees(rel_rot[i], decoded));
+			}
+		}
+		if (max_angle_error <= budget.max_angle_degrees)
+			break;
+	}
+	rot_bits = std::min(rot_bits, kMaxRotBits);
+
+	/* Root translations: error is half a step on the widest axis */
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (int k = 0; k < nkeys; k++) {
+		lo = glm::min(lo, timeline.rootTrans(k));
+		hi = glm::max(hi, timeline.rootTrans(k));
+	}
+	float range = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+	for (trans_bits = kMinTransBits; trans_bits < kMaxTransBits; trans_bits++)
+		if (0.5f * range / float((uint64_t(1) << trans_bits) - 1) <= budget.max_translation)
+			break;
+	trans_min = lo;
+	trans_step = (hi - lo) / float((uint64_t(1) << trans_bits) - 1);
+
+	pack(timeline);
+
+	max_trans_error = 0.0f;
+	std::vector<glm::fquat> rel_rot(njoints);
+	glm::vec3 root_trans;
+	for (int k = 0; k < nkeys; k++) {
+		decodeKey(k, rel_rot.data(), &root_trans);
+		glm::vec3 err = glm::abs(root_trans - timeline.rootTrans(k));
+		max_trans_error = std::max(max_trans_error, std::max(err.x, std::max(err.y, err.z)));
+	}
+}
+
+void CompressedClip::pack(const Timeline& timeline)
+{
+	size_t stride = keyBits();
+	bits.assign(size_t(nkeys) * stride / 64 + 1, 0);
+	for (int k = 0; k < nkeys; k++) {
+		size_t pos = size_t(k) * stride;
+		const glm::vec3& root_trans = timeline.rootTrans(k);
+		for (int a = 0; a < 3; a++) {
+			writeBits(bits, pos, quantize(root_trans[a], trans_min[a], trans_step[a], trans_bits), trans_bits);
+			pos += trans_bits;
+		}
+		const glm::fquat* rel_rot = timeline.relRot(k);
+		for (int i = 0; i < njoints; i++) {
+			uint32_t q[3];
+			int largest = smallestThree(rel_rot[i], rot_bits, q);
+			writeBits(bits, pos, uint32_t(largest), 2);
+			pos += 2;
+			for (int j = 0; j < 3; j++) {
+				writeBits(bits, pos, q[j], rot_bits);
+				pos += rot_bits;
+			}
+		}
+	}
+}
+
+void CompressedClip::decodeKey(int key, glm::fquat* rel_rot, glm::vec3* root_trans) const
+{
+	size_t pos = size_t(key) * keyBits();
+	for (int a = 0; a < 3; a++) {
+		(*root_trans)[a] = trans_min[a] + trans_step[a] * readBits(bits, pos, trans_bits);
+		pos += trans_bits;
+	}
+	for (int i = 0; i < njoints; i++) {
+		int largest = int(readBits(bits, pos, 2));
+		pos += 2;
+		uint32_t q[3];
+		for (int j = 0; j < 3; j++) {
+			q[j] = readBits(bits, pos, rot_bits);
+			pos += rot_bits;
+		}
+		rel_rot[i] = fromSmallestThree(largest, q, rot_bits);
+	}
+}
+
+void CompressedClip::sample(float t, glm::fquat* rel_rot, glm::vec3* root_trans) const
+{
+	if (nkeys == 1 || t <= time.front()) {
+		decodeKey(0, rel_rot, root_trans);
+		return;
+	}
+	if (t >= time.back()) {
+		decodeKey(nkeys - 1, rel_rot, root_trans);
+		return;
+	}
+	float percent;
+	int segment = locateSegment(time.data(), nkeys, t, &percent, cursor_);
+	if (segment != decoded_segment_) {
+		from_.resize(njoints);
+		to_.resize(njoints);
+		if (decoded_segment_ != -1 && segment == decoded_segment_ + 1) {
+			std::swap(from_, to_);
+			from_trans_ = to_trans_;
+		} else {
+			decodeKey(segment, from_.data(), &from_trans_);
+		}
+		decodeKey(segment + 1, to_.data(), &to_trans_);
+		decoded_segment_ = segment;
+	}
+	quatSlerpBatch(from_.data(), to_.data(), percent, rel_rot, njoints);
+	*root_trans = glm::mix(from_trans_, to_trans_, percent);
+}
+
+size_t CompressedClip::compressedBytes() const
+{
+	return sizeof(CompressedClipHeader) + time.size() * sizeof(float) + bits.size() * sizeof(uint64_t);
+}
+
+size_t CompressedClip::rawBytes() const
+{
+	return size_t(nkeys) * (njoints * sizeof(glm::fquat) + sizeof(glm::vec3) + sizeof(float));
+}
+
+float CompressedClip::compressionRatio() const
+{
+	return empty() ? 0.0f : float(rawBytes()) / float(compressedBytes());
+}
+
+bool CompressedClip::saveTo(const std::string& fn, uint64_t keys_hash) const
+{
+	std::ofstream file(fn, std::ios::binary);
+	if (!file) {
+		std::cerr << "Cannot write compressed clip " << fn << std::endl;
+		return false;
+	}
+	CompressedClipHeader header;
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.njoints = njoints;
+	header.nkeys = nkeys;
+	header.rot_bits = rot_bits;
+	header.trans_bits = trans_bits;
+	for (int a = 0; a < 3; a++) {
+		header.trans_min[a] = trans_min[a];
+		header.trans_step[a] = trans_step[a];
+	}
+	header.max_angle_error = max_angle_error;
+	header.max_trans_error = max_trans_error;
+	header.keys_hash = keys_hash;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(time.data()), time.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(bits.data()), bits.size() * sizeof(uint64_t));
+	return bool(file);
+}
+
+bool CompressedClip::loadFrom(const std::string& fn, uint64_t keys_hash)
+{
+	std::ifstream file(fn, std::ios::binary);
+	if (!file)
+		return false;
+	clear();
+	CompressedClipHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+	    header.version != kVersion || header.njoints <= 0 || header.nkeys <= 0 ||
+	    header.rot_bits < kMinRotBits || header.rot_bits > kMaxRotBits ||
+	    header.trans_bits < kMinTransBits || header.trans_bits > kMaxTransBits) {
+		std::cerr << fn << " is not a compressed clip" << std::endl;
+		return false;
+	}
+	if (header.keys_hash != keys_hash) {
+		std::cerr << fn << " was encoded from other keyframes, ignoring it" << std::endl;
+		return false;
+	}
+	njoints = header.njoints;
+	nkeys = header.nkeys;
+	rot_bits = header.rot_bits;
+	trans_bits = header.trans_bits;
+	trans_min = glm::vec3(header.trans_min[0], header.trans_min[1], header.trans_min[2]);
+	trans_step = glm::vec3(header.trans_step[0], header.trans_step[1], header.trans_step[2]);
+	max_angle_error = header.max_angle_error;
+	max_trans_error = header.max_trans_error;
+	time.resize(nkeys);
+	bits.resize(size_t(nkeys) * keyBits() / 64 + 1);
+	file.read(reinterpret_cast<char*>(time.data()), time.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(bits.data()), bits.size() * sizeof(uint64_t));
+	if (!file) {
+		std::cerr << fn << " is truncated" << std::endl;
+		clear();
+		return false;
+	}
+	return true;
+}
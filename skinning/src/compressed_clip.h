@@ -0,0 +1,81 @@
+#ifndef COMPRESSED_CLIP_H
+#define COMPRESSED_CLIP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+class Timeline;
+
+/*
+ * Largest error a CompressedClip may introduce.
+ */
+struct CompressionBudget {
+	float max_angle_degrees = 0.05f; // per joint rotation
+	float max_translation = 1e-3f;   // per root translation axis
+};
+
+/*
+ * Quantized copy of a Timeline.
+ *
+ * Each rotation is stored "smallest three": the index of its largest
+ * component in 2 bits, then the other three components quantized to
+ * rot_bits each. The largest one is implied by unit length. Root
+ * translations are fixed point over the clip's range, trans_bits per
+ * axis. Keys are packed back to back in one bit stream, so any key can
+ * be decoded on its own.
+ *
+ * encode picks the fewest bits that keep every key within the budget,
+ * measured after a round trip.
+ *
+ * revision is the Timeline::revision() the clip was encoded from. Its
+ * side file records TimelineKeys::hash() of those keys instead, and
+ * loadFrom refuses a file made from other keys.
+ */
+struct CompressedClip {
+	int njoints = 0;
+	int nkeys = 0;
+	int rot_bits = 0;
+	int trans_bits = 0;
+	glm::vec3 trans_min = glm::vec3(0.0f);
+	glm::vec3 trans_step = glm::vec3(0.0f);
+	std::vector<float> time;
+	std::vector<uint64_t> bits;
+	unsigned revision = 0;
+
+	/* Worst case over the clip, measured by encode */
+	float max_angle_error = 0.0f; // degrees
+	float max_trans_error = 0.0f;
+
+	bool empty() const { return nkeys == 0; }
+	void clear();
+	void encode(const Timeline& timeline, const CompressionBudget& budget);
+	void decodeKey(int key, glm::fquat* rel_rot, glm::vec3* root_trans) const;
+
+	/*
+	 * Pose at time t, decoding at most the two keys around it straight
+	 * into rel_rot. The last decoded segment is kept, so sequential
+	 * playback decodes each key once.
+	 */
+	void sample(float t, glm::fquat* rel_rot, glm::vec3* root_trans) const;
+
+	size_t compressedBytes() const;
+	size_t rawBytes() const; // same keys as float quaternions, vectors and times
+	float compressionRatio() const;
+
+	bool saveTo(const std::string& fn, uint64_t keys_hash) const;
+	bool loadFrom(const std::string& fn, uint64_t keys_hash);
+
+private:
+	size_t keyBits() const { return 3 * size_t(trans_bits) + size_t(njoints) * (2 + 3 * rot_bits); }
+	void pack(const Timeline& timeline);
+
+	mutable int cursor_ = 0;
+	mutable int decoded_segment_ = -1;
+	mutable std::vector<glm::fquat> from_, to_;
+	mutable glm::vec3 from_trans_, to_trans_;
+};
+
+#endif
@@ -11,6 +11,8 @@
 #include <glm/gtx/transform.hpp>
 
 namespace {
+	const char* kAnimationFile = "animation.json";
+
 	// FIXME: Implement a function that performs proper
 	//        ray-cylinder intersection detection
 	// TIPS: The implement is provided by the ray-tracer starter code.
@@ -45,6 +47,34 @@ void GUI::assignMesh(Mesh* mesh)
 {
 	mesh_ = mesh;
 	center_ = mesh_->getCenter();
+	last_autosave_ = std::chrono::steady_clock::now();
+}
+
+void GUI::saveAnimation(const std::string& fn)
+{
+	mesh_->journal.beginCompaction(mesh_->timeline);
+	saver_.save(mesh_->snapshotAnimation(), fn);
+	compacting_to_ = fn;
+}
+
+void GUI::updateSaving()
+{
+	if (saver_.poll() && saver_.lastFile() == compacting_to_) {
+		mesh_->journal.finishCompaction(compacting_to_, saver_.lastSucceeded());
+		compacting_to_.clear();
+	}
+	mesh_->journal.flushIfOlderThan(journal_batch_seconds_);
+	if (mesh_->journal.needsCompaction() && !mesh_->journal.isCompacting())
+		saveAnimation(mesh_->journal.baseFile());
+
+	auto now = std::chrono::steady_clock::now();
+	if (saver_.isSaving() || mesh_->timeline.empty() ||
+	    mesh_->timeline.revision() == autosaved_revision_ ||
+	    now - last_autosave_ < std::chrono::duration<float>(autosave_interval_))
+		return;
+	saver_.save(mesh_->snapshotAnimation(), "animation.autosave.vma");
+	autosaved_revision_ = mesh_->timeline.revision();
+	last_autosave_ = now;
 }
 
 void GUI::keyCallback(int key, int scancode, int action, int mods)
@@ -64,8 +94,17 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 		std::cout << "File saved!" << std::endl;
 	}
 	if (key == GLFW_KEY_S && (mods & GLFW_MOD_CONTROL)) {
-		if (action == GLFW_RELEASE)
-			mesh_->saveAnimationTo("animation.json");
+		// Ctrl+S only commits the journal once animation.json has been
+		// written; Ctrl+Shift+S always writes the whole file.
+		AnimationJournal& journal = mesh_->journal;
+		if (action == GLFW_RELEASE && !journal.isCompacting()) {
+			if (!(mods & GLFW_MOD_SHIFT) && journal.isAttached() && journal.baseFile() == kAnimationFile) {
+				if (journal.flush())
+					std::cout << "Saved edits to " << kAnimationFile << ".journal" << std::endl;
+			} else {
+				saveAnimation(kAnimationFile);
+			}
+		}
 		return ;
 	}
 
@@ -79,22 +118,20 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 			roll_speed = roll_speed_;
 		// FIXME: actually roll the bone here
 		if (current_bone_ != -1) {
-			Joint curr_joint = mesh_->skeleton.joints[current_bone_];
+			Skeleton& skeleton = mesh_->skeleton;
+			skeleton.updateDirty(); // The axis of the bone as it is now
 			glm::vec3 parent_joint_loc;
-			if (curr_joint.parent_index == -1) {
+			if (skeleton.parent[current_bone_] == -1) {
 				parent_joint_loc = glm::vec3(0, 0, 0);
 			}
 			else {
-				parent_joint_loc = mesh_->skeleton.joints[curr_joint.parent_index].position;
+				parent_joint_loc = skeleton.jointEnd(skeleton.parent[current_bone_]);
 			}
-			/*glm::vec3 beg_pos = curr_joint.position;
-			glm::vec3 end_pos = parent_joint_loc;*/
 			glm::vec3 beg_pos = parent_joint_loc;
-			glm::vec3 end_pos = curr_joint.position;
+			glm::vec3 end_pos = skeleton.jointEnd(current_bone_);
 
 			glm::vec3 cylinder_axis = glm::normalize(end_pos - beg_pos);
-			glm::mat4 rotation_matrix = glm::rotate(roll_speed, cylinder_axis);
-			updateAllTransformations(current_bone_, rotation_matrix, true);
+			updateAllTransformations(current_bone_, glm::angleAxis(roll_speed, cylinder_axis));
 			pose_changed_ = true;
 		}
 	} else if (key == GLFW_KEY_C && action != GLFW_RELEASE) {
@@ -112,14 +149,32 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 	}
 	else if (key == GLFW_KEY_F && action == GLFW_RELEASE) {
 		//std::cerr << "F" << std::endl;
-		mesh_->addKeyframe();
-		Keyframe* keyframe = mesh_->getLastKeyFrame();
-		keyframe->texture.create(preview_width_, preview_height_);
-		texture_to_render = &(keyframe->texture);
+		mesh_->addKeyframe(); // Its preview is made once it is in view
 		/*keyframe->texture.bind();
 		CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
 		keyframe->texture.unbind();*/
 	}
+	else if (key == GLFW_KEY_B && action == GLFW_RELEASE) {
+		std::cout << "Baking animation at " << bake_rate_ << " Hz..." << std::endl;
+		mesh_->bake(bake_rate_);
+		std::cout << (mesh_->baked_clip ? mesh_->baked_clip->nframes : 0) << " frames baked" << std::endl;
+	}
+	else if (key == GLFW_KEY_X && action == GLFW_RELEASE) {
+		mesh_->compressAnimation();
+		const CompressedClip& clip = *mesh_->compressed_clip;
+		std::cout << "Compressed " << clip.nkeys << " keyframes: "
+		          << clip.rawBytes() << " -> " << clip.compressedBytes() << " bytes ("
+		          << clip.compressionRatio() << "x), max error "
+		          << clip.max_angle_error << " degrees, "
+		          << clip.max_trans_error << " translation" << std::endl;
+	}
+	else if (key == GLFW_KEY_K && action == GLFW_RELEASE && !play_) {
+		int before = mesh_->timeline.size();
+		int removed = mesh_->reduceKeyframes(reduction_error_);
+		std::cout << "Reduced " << before << " keyframes to " << before - removed << std::endl;
+		selected_keyframe = -1;
+		pose_changed_ = true;
+	}
 	else if (key == GLFW_KEY_R && action == GLFW_RELEASE) {
 		//std::cerr << "R" << std::endl;
 		mesh_->setPoseFromKeyframe(0);
@@ -157,16 +212,16 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 		if (selected_keyframe < 0) {
 			selected_keyframe = 0;
 		}
-		if (mesh_->keyframes.size() == 0) {
+		if (mesh_->timeline.empty()) {
 			selected_keyframe = -1;
 		}
 	}
 	else if (key == GLFW_KEY_PAGE_DOWN && action == GLFW_RELEASE) {
 		selected_keyframe += 1;
-		if (selected_keyframe >= (int)(mesh_->keyframes.size())) {
-			selected_keyframe = (int)(mesh_->keyframes.size()-1);
+		if (selected_keyframe >= mesh_->timeline.size()) {
+			selected_keyframe = mesh_->timeline.size()-1;
 		}
-		if (mesh_->keyframes.size() == 0) {
+		if (mesh_->timeline.empty()) {
 			selected_keyframe = -1;
 		}
 	}
@@ -179,10 +234,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 	else if (key == GLFW_KEY_U && action == GLFW_RELEASE) {
 		if (selected_keyframe != -1 && !play_) {
 			mesh_->updateKeyframe(selected_keyframe);
-			Keyframe* keyframe = mesh_->keyframes[selected_keyframe];
-			keyframe->texture.~TextureToRender();
-			keyframe->texture.create(preview_width_, preview_height_);
-			texture_to_render = &(keyframe->texture);
+			preview_to_render = mesh_->timeline.handle(selected_keyframe);
 			pose_changed_ = true;
 		}
 	}
@@ -201,84 +253,14 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 	// FIXME: implement other controls here.
 }
 
-void GUI::updateAllTransformations(int curr_bone, glm::mat4 updateT, bool use_update)
+void GUI::updateAllTransformations(int curr_bone, const glm::fquat& update)
 {
-	Joint* curr_joint = &mesh_->skeleton.joints[curr_bone];
-	int parent_index = curr_joint->parent_index;
-	Joint* parent_joint;
-
-	if (use_update) {
-		//std::cerr << curr_bone << std::endl;
-		if (parent_index == -1) {
-			curr_joint->T = updateT * curr_joint->T;
-
-			//curr_joint->orientation = glm::quat_cast(updateT * glm::mat4(curr_joint->orientation));
-			/*curr_joint->skinning_T = updateT * curr_joint->skinning_T;*/
-		}
-		/*curr_joint->passed_up_T = updateT * curr_joint->passed_up_T;*/
-		else {
-			parent_joint = &mesh_->skeleton.joints[parent_index];
-			/*parent_joint->skinning_T = updateT * parent_joint->skinning_T;
-			parent_joint->skinning_D = mesh_->calculateSkinningD(parent_index);*/
-			curr_joint->T = updateT * curr_joint->T;
-			//curr_joint->orientation = glm::quat_cast(updateT * glm::mat4(curr_joint->orientation));
-		}
-	}
-	if (parent_index != -1) {
-		parent_joint = &mesh_->skeleton.joints[parent_index];
-		curr_joint->D = mesh_->calculateD(curr_bone);
-		//parent_joint->D = mesh_->calculateD(curr_bone);
-		curr_joint->position = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_position, 1));
-		curr_joint->wcoord = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_wcoord, 1));
-		/*curr_joint->skinning_D = mesh_->calculateSkinningD(curr_bone);
-		curr_joint->skinning_position = glm::vec3(curr_joint->skinning_D * glm::inverse(curr_joint->skinning_U) * glm::vec4(curr_joint->init_position, 1));*/
-		//std::cerr << "Correct position: " << glm::to_string(curr_joint->position) << ", other position: " << glm::to_string(curr_joint->skinning_position) << std::endl;
-		//curr_joint->position = glm::vec3(curr_joint->skinning_D * glm::inverse(curr_joint->skinning_U) * glm::vec4(curr_joint->init_position, 1));
-		glm::mat4 extract_translation = glm::mat4(0.0f);
-		extract_translation[3] = -((curr_joint->D * glm::inverse(curr_joint->U))[3]);
-		//extract_translation[3] = -((parent_joint->D * glm::inverse(parent_joint->U))[3]);
-		extract_translation[3][3] = 0;
-		/*curr_joint->orientation = glm::quat_cast(curr_joint->skinning_D * glm::inverse(curr_joint->skinning_U) + extract_translation);*/
-		//curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);
-		if (use_update || true) {
-			//updateAllParentsOrientation(current_bone_);
-			/*extract_translation[3] = -((curr_joint->D * glm::inverse(curr_joint->U))[3]);
-			extract_translation[3][3] = 0;*/
-			/*parent_joint->orientation = glm::quat_cast(parent_joint->skinning_D * glm::inverse(parent_joint->skinning_U) + extract_translation);*/
-			//parent_joint->D = curr_joint->D;
-			//parent_joint->U = curr_joint->U;
-			curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);
-			curr_joint->rel_orientation = glm::quat_cast(curr_joint->T);
-			//parent_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);
-			//std::cerr << "Parent: " << glm::to_string(parent_joint->orientation) << " - " << glm::length(parent_joint->orientation) << std::endl;
-			//parent_joint->orientation = glm::quat_cast(mesh_->calculateD(parent_index, curr_joint->passed_up_T) * glm::inverse(parent_joint->skinning_U) + extract_translation);
-		}
-		//curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U));
-		//std::cerr << glm::to_string(curr_joint->position) << std::endl;
-		//std::cerr << glm::to_string(curr_joint->orientation) << std::endl;
-		//std::cerr << glm::to_string(curr_joint->D) << " \ncompared to\n " << glm::to_string(curr_joint->skinning_D) << std::endl << std::endl;
-		/*parent_joint->D = mesh_->calculateD(parent_index, parent_joint->passed_up_T);
-		parent_joint->position = glm::vec3(parent_joint->D * glm::inverse(parent_joint->U) * glm::vec4(parent_joint->init_position, 1));
-		parent_joint->orientation = glm::quat_cast(updateT * parent_joint->passed_up_T);*/
-	}
-	else {
-		curr_joint->D = mesh_->calculateD(curr_bone);
-		/*curr_joint->position = curr_joint->T * glm::vec4(curr_joint->init_position, 1);*/
-		curr_joint->position = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_position, 1));
-		curr_joint->wcoord = glm::vec3(curr_joint->D * glm::inverse(curr_joint->U) * glm::vec4(curr_joint->init_wcoord, 1));
-		glm::mat4 extract_translation = glm::mat4(0.0f);
-		extract_translation[3] = -((curr_joint->D * glm::inverse(curr_joint->U))[3]);
-		extract_translation[3][3] = 0;
-		//curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);
-		//curr_joint->orientation = glm::quat_cast(curr_joint->T);
-		/*curr_joint->orientation = glm::quat_cast(curr_joint->skinning_D * glm::inverse(curr_joint->skinning_U) + extract_translation);*/
-		curr_joint->orientation = glm::quat_cast(curr_joint->D * glm::inverse(curr_joint->U) + extract_translation);
-	}
-	for (auto child : curr_joint->children)
-	{
-		updateAllTransformations(child, glm::mat4(1.0f), false);
-	}
-	//std::cout << "Bone: " << curr_bone << ", Beginning: " << glm::to_string(curr_joint->wcoord) << ", End: " << glm::to_string(curr_joint->position) << std::endl;
+	Skeleton& skeleton = mesh_->skeleton;
+	skeleton.local_rot[curr_bone] = glm::normalize(update * skeleton.local_rot[curr_bone]);
+	// Ancestors are untouched, so only this subtree needs forward kinematics.
+	// It runs in Mesh::updateAnimation, or earlier when a handler needs
+	// joint positions, and covers every edit made since.
+	skeleton.markDirty(curr_bone);
 }
 
 int GUI::intersectCylinder(glm::vec3 direction, glm::vec3 position)
@@ -287,19 +269,22 @@ int GUI::intersectCylinder(glm::vec3 direction, glm::vec3 position)
 	int best_i = -1;
 	auto epsilon = 1e-7;
 
-	for (int i = 0; (unsigned)i < mesh_->skeleton.joints.size(); i++) {
-		Joint curr_joint = mesh_->skeleton.joints[i];
+	// Bones dragged since the last frame are picked where they are now,
+	// not where the last frame drew them. Nothing runs if none were.
+	Skeleton& skeleton = mesh_->skeleton;
+	skeleton.updateDirty();
+	for (int i = 0; i < skeleton.getNumberOfJoints(); i++) {
 		glm::vec3 parent_joint_loc;
-		if (curr_joint.parent_index == -1) {
+		if (skeleton.parent[i] == -1) {
 			parent_joint_loc = glm::vec3(0, 0, 0);
 		}
 		else {
-			parent_joint_loc = mesh_->skeleton.joints[curr_joint.parent_index].position;
+			parent_joint_loc = skeleton.jointEnd(skeleton.parent[i]);
 		}
 
 
 		glm::vec3 beg_pos = parent_joint_loc;
-		glm::vec3 end_pos = curr_joint.position;
+		glm::vec3 end_pos = skeleton.jointEnd(i);
 
 		/*glm::vec3 cylinder_axis = glm::normalize(beg_pos - end_pos);*/
 		glm::vec3 cylinder_axis = glm::normalize(end_pos - beg_pos);
@@ -413,9 +398,9 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 			glm::vec3(mouse_direction.y, -mouse_direction.x, 0.0f)
 		);
 
-		Joint curr_joint = mesh_->skeleton.joints[current_bone_];
-		glm::vec3 end_pos = curr_joint.position;
-		glm::vec3 beg_pos = curr_joint.wcoord;
+		// intersectCylinder above brought the skeleton up to date.
+		glm::vec3 end_pos = mesh_->skeleton.jointEnd(current_bone_);
+		glm::vec3 beg_pos = mesh_->skeleton.jointBegin(current_bone_);
 
 		glm::vec3 cylinder_axis = glm::normalize(beg_pos - end_pos);
 
@@ -427,8 +412,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 		if (std::abs(rotation_amount) < 1e-6) {
 			return;
 		}
-		glm::mat4 rotation_matrix = glm::rotate(rotation_amount, look_);
-		updateAllTransformations(current_bone_, rotation_matrix, true);
+		updateAllTransformations(current_bone_, glm::angleAxis(rotation_amount, look_));
 		pose_changed_ = true;
 		return ;
 	}
@@ -453,7 +437,7 @@ void GUI::mouseButtonCallback(int button, int action, int mods)
 		/*std::cerr << "Left click at: " << current_x_ << ", " << current_y_ << " with current scroll: " << current_scroll  << " frame: " << 
 			(view_height_ - current_y_ - current_scroll)/preview_height_<< std::endl;*/
 		int attempted_keyframe = (view_height_ - current_y_ - current_scroll) / preview_height_;
-		if (attempted_keyframe >= 0 && attempted_keyframe < (int)(mesh_->keyframes.size())) {
+		if (attempted_keyframe >= 0 && attempted_keyframe < mesh_->timeline.size()) {
 			selected_keyframe = attempted_keyframe;
 		}
 	}
@@ -464,7 +448,7 @@ void GUI::mouseScrollCallback(double dx, double dy)
 	if (current_x_ < view_width_)
 		return;
 	// FIXME: Mouse Scrolling
-	if (mesh_->keyframes.size() == 0) {
+	if (mesh_->timeline.empty()) {
 		current_scroll = 0;
 		return;
 	}
@@ -472,8 +456,8 @@ void GUI::mouseScrollCallback(double dx, double dy)
 	if (current_scroll > 0) {
 		current_scroll = 0;
 	}
-	if (current_scroll < -(int)(mesh_->keyframes.size()-1) * preview_height_) {
-		current_scroll = -(int)(mesh_->keyframes.size()-1) * preview_height_;
+	if (current_scroll < -(mesh_->timeline.size()-1) * preview_height_) {
+		current_scroll = -(mesh_->timeline.size()-1) * preview_height_;
 	}
 }
 
@@ -522,6 +506,13 @@ float GUI::getCurrentPlayTime() const
 	return dur.count()-pause_dur.count();
 }
 
+TextureToRender* GUI::getTextureToRender()
+{
+	// The keyframe may have been deleted before its preview got rendered,
+	// or never have been in view.
+	return mesh_->timeline.findPreview(preview_to_render);
+}
+
 
 bool GUI::captureWASDUPDOWN(int key, int action)
 {
@@ -3,11 +3,15 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <GLFW/glfw3.h>
 
 #include <chrono>
+#include <string>
 #include <glm/gtx/string_cast.hpp>
 #include "texture_to_render.h"
+#include "animation_saver.h"
+#include "timeline.h"
 
 struct Mesh;
 
@@ -50,9 +54,20 @@ public:
 	bool isPlaying() const { return play_; }
 	float getCurrentPlayTime() const;
 
+	/*
+	 * Ctrl+S and the autosave write on a worker thread. Call once per
+	 * frame to finish saves, commit the journal every
+	 * journal_batch_seconds_ and autosave edits every autosave_interval_
+	 * seconds.
+	 */
+	void updateSaving();
+	void saveAnimation(const std::string& fn); // The whole file, in the background
+	bool isSaving() const { return saver_.isSaving(); }
+	float getSaveProgress() const { return saver_.progress(); }
+
 	void* pixel_buffer;
-	TextureToRender* getTextureToRender() { return texture_to_render; }
-	void resetTexture() { texture_to_render = nullptr; }
+	TextureToRender* getTextureToRender();
+	void resetTexture() { preview_to_render = -1; }
 
 	int current_scroll = 0;
 	int selected_keyframe = -1;
@@ -77,6 +92,10 @@ private:
 	float pan_speed_ = 0.1f;
 	float rotation_speed_ = 0.02f;
 	float zoom_speed_ = 0.1f;
+	float bake_rate_ = 60.0f;
+	float reduction_error_ = 0.01f;
+	float autosave_interval_ = 60.0f;
+	float journal_batch_seconds_ = 1.0f;
 	float aspect_;
 
 	float scroll_speed = 20.0f;
@@ -99,11 +118,16 @@ private:
 	bool reset_ = true;
 
 	int intersectCylinder(glm::vec3 direction, glm::vec3 position);
-	void updateAllTransformations(int curr_bone, glm::mat4 updateT, bool use_update);
+	void updateAllTransformations(int curr_bone, const glm::fquat& update);
 
 	std::chrono::time_point<std::chrono::system_clock> start, curr_time, pause_start;
 	std::chrono::duration<float> dur, pause_dur;
-	TextureToRender* texture_to_render = nullptr;
+	Timeline::Handle preview_to_render = -1; // Of the keyframe whose preview is stale
+
+	AnimationSaver saver_;
+	unsigned autosaved_revision_ = 0;
+	std::chrono::steady_clock::time_point last_autosave_;
+	std::string compacting_to_; // File the running full save will start a new journal for
 };
 
 #endif
@@ -0,0 +1,121 @@
+#include "bone_geometry.h"
+#include "pose_kernels.h"
+#include <algorithm>
+#include <vector>
+
+/*
+ * Keyframe reduction for dense motion such as imported captures.
+ *
+ * A keyframe can go if interpolating between the keyframes kept around it
+ * puts every joint within max_error of where the keyframe itself puts it,
+ * measured in model space. The timeline is cut into chunks whose first and
+ * last keyframes are always kept, and each chunk is reduced greedily on
+ * its own thread: extend the current segment as far as every keyframe
+ * inside it stays within the bound, then start a new one from its end.
+ */
+
+namespace {
+	const int kChunkSize = 256;
+
+	/*
+	 * Both ends of every joint, after forward kinematics.
+	 */
+	void jointPositions(Skeleton& skeleton, glm::vec3* out)
+	{
+		skeleton.forwardKinematics();
+		int njoints = skeleton.getNumberOfJoints();
+		for (int i = 0; i < njoints; i++) {
+			out[2 * i] = skeleton.jointBegin(i);
+			out[2 * i + 1] = skeleton.jointEnd(i);
+		}
+	}
+
+	bool withinBound(const glm::vec3* a, const glm::vec3* b, int n, float max_error2)
+	{
+		for (int i = 0; i < n; i++) {
+			glm::vec3 d = a[i] - b[i];
+			if (glm::dot(d, d) > max_error2)
+				return false;
+		}
+		return true;
+	}
+
+	/*
+	 * Can every keyframe strictly between from and to be rebuilt by
+	 * interpolating those two?
+	 */
+	bool spanFits(const Timeline& timeline, int from, int to,
+	              const std::vector<glm::vec3>& reference,
+	              Skeleton& pose, std::vector<glm::vec3>& positions, float max_error2)
+	{
+		int njoints = timeline.getNumberOfJoints();
+		int npositions = 2 * njoints;
+		float span = timeline.time(to) - timeline.time(from);
+		for (int k = from + 1; k < to; k++) {
+			float percent = span > 0.0f ? (timeline.time(k) - timeline.time(from)) / span : 0.0f;
+			quatSlerpBatch(timeline.relRot(from), timeline.relRot(to), percent,
+			               pose.local_rot.data(), njoints);
+			pose.root_trans = glm::mix(timeline.rootTrans(from), timeline.rootTrans(to), percent);
+			jointPositions(pose, positions.data());
+			if (!withinBound(positions.data(), &reference[size_t(k) * npositions], npositions, max_error2))
+				return false;
+		}
+		return true;
+	}
+}
+
+int Mesh::reduceKeyframes(float max_error)
+{
+	int nkeys = timeline.size();
+	if (nkeys < 3)
+		return 0;
+	int njoints = skeleton.getNumberOfJoints();
+	int npositions = 2 * njoints;
+	float max_error2 = max_error * max_error;
+
+	/* Joint positions of every keyframe as authored */
+	std::vector<glm::vec3> reference(size_t(nkeys) * npositions);
+	#pragma omp parallel
+	{
+		Skeleton pose = skeleton;
+		#pragma omp for schedule(static)
+		for (int k = 0; k < nkeys; k++) {
+			const glm::fquat* rel_rot = timeline.relRot(k);
+			std::copy(rel_rot, rel_rot + njoints, pose.local_rot.begin());
+			pose.root_trans = timeline.rootTrans(k);
+			jointPositions(pose, &reference[size_t(k) * npositions]);
+		}
+	}
+
+	std::vector<char> keep(nkeys, 0);
+	int nchunks = (nkeys - 1 + kChunkSize - 1) / kChunkSize;
+	for (int c = 0; c < nchunks; c++)
+		keep[c * kChunkSize] = 1;
+	keep[nkeys - 1] = 1;
+	#pragma omp parallel
+	{
+		Skeleton pose = skeleton;
+		std::vector<glm::vec3> positions(npositions);
+		#pragma omp for schedule(dynamic)
+		for (int c = 0; c < nchunks; c++) {
+			int begin = c * kChunkSize;
+			int end = std::min(begin + kChunkSize, nkeys - 1);
+			int from = begin;
+			while (from < end) {
+				int to = from + 1;
+				while (to < end && spanFits(timeline, from, to + 1, reference, pose, positions, max_error2))
+					to++;
+				if (to < end)
+					keep[to] = 1;
+				from = to;
+			}
+		}
+	}
+
+	int removed = int(std::count(keep.begin(), keep.end(), 0));
+	if (removed > 0) {
+		timeline.retain(keep);
+		journal.recordRetain(keep);
+	}
+	return removed;
+}
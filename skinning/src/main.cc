@@ -1,11 +1,13 @@
 #include <GL/glew.h>
 
 #include "bone_geometry.h"
+#include "animation_file.h"
 #include "procedure_geometry.h"
 #include "render_pass.h"
 #include "config.h"
 #include "gui.h"
 #include "texture_to_render.h"
+#include "texture_registry.h"
 
 #include <memory>
 #include <algorithm>
@@ -118,10 +120,20 @@ int main(int argc, char* argv[])
 {
 	if (argc < 2) {
 		std::cerr << "Input model file is missing" << std::endl;
-		std::cerr << "Usage: " << argv[0] << " <PMD file>" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " <PMD file> [animation file or VMD motion]" << std::endl;
+		std::cerr << "       " << argv[0] << " --convert <animation file> <animation file>" << std::endl;
 		return -1;
 	}
+	if (std::string(argv[1]) == "--convert") {
+		if (argc < 4) {
+			std::cerr << "--convert needs an input and an output file" << std::endl;
+			return -1;
+		}
+		return convertAnimationFile(argv[2], argv[3]) ? 0 : -1;
+	}
 	GLFWwindow *window = init_glefw();
+	// Where the GL takes them, textures are kept BC1/BC3 compressed.
+	TextureRegistry::instance().setCompression(GLEW_EXT_texture_compression_s3tc);
 	GUI gui(window, main_view_width, main_view_height, preview_height, preview_width);
 
 	std::vector<glm::vec4> floor_vertices;
@@ -153,7 +165,7 @@ int main(int argc, char* argv[])
 	gui.assignMesh(&mesh);
 
 	gui.pixel_buffer = malloc(main_view_height * main_view_width * 3);
-	mesh.keyframes.clear();
+	mesh.timeline.clear();
 
 	glm::vec4 light_position = glm::vec4(0.0f, 100.0f, 0.0f, 1.0f);
 
@@ -209,6 +221,7 @@ int main(int argc, char* argv[])
 
 	std::function<std::vector<glm::vec3>()> trans_data = [&mesh](){ return mesh.getCurrentQ()->transData(); };
 	std::function<std::vector<glm::fquat>()> rot_data = [&mesh](){ return mesh.getCurrentQ()->rotData(); };
+	std::function<std::vector<glm::mat4>()> palette_data = [&mesh](){ return mesh.getCurrentQ()->paletteData(); };
 	// FIXME: define more ShaderUniforms for RenderPass if you want to use it.
 	//        Otherwise, do whatever you like here
 	glm::mat4 cylinder_rotation;
@@ -232,6 +245,7 @@ int main(int argc, char* argv[])
 	std::function<bool()> show_border_data = [&preview_show_border]() {return preview_show_border; };
 	auto joint_trans = make_uniform("joint_trans", trans_data);
 	auto joint_rot = make_uniform("joint_rot", rot_data);
+	auto skinning_palette = make_uniform("skinning_palette", palette_data);
 	auto orthomat = make_uniform("orthomat", ortho_data);
 	auto frame_shift = make_uniform("frame_shift", frame_shift_data);
 	auto show_border = make_uniform("show_border", show_border_data);
@@ -311,7 +325,7 @@ int main(int argc, char* argv[])
 			{ std_model, std_view, std_proj,
 			  std_light,
 			  std_camera, object_alpha,
-			  joint_trans, joint_rot
+			  skinning_palette
 			},
 			{ "fragment_color" }
 			);
@@ -321,13 +335,13 @@ int main(int argc, char* argv[])
 	//        initialized
 	std::vector<int> bone_vertex_id;
 	std::vector<glm::uvec2> bone_indices;
-	for (int i = 0; i < (int)mesh.skeleton.joints.size(); i++) {
+	for (int i = 0; i < mesh.skeleton.getNumberOfJoints(); i++) {
 		bone_vertex_id.emplace_back(i);
 	}
-	for (const auto& joint: mesh.skeleton.joints) {
-		if (joint.parent_index < 0)
+	for (int i = 0; i < mesh.skeleton.getNumberOfJoints(); i++) {
+		if (mesh.skeleton.parent[i] < 0)
 			continue;
-		bone_indices.emplace_back(joint.joint_index, joint.parent_index);
+		bone_indices.emplace_back(i, mesh.skeleton.parent[i]);
 	}
 	RenderDataInput bone_pass_input;
 	bone_pass_input.assign(0, "jid", bone_vertex_id.data(), bone_vertex_id.size(), 1, GL_UNSIGNED_INT);
@@ -366,12 +380,36 @@ int main(int argc, char* argv[])
 	bool draw_object = true;
 	bool draw_cylinder = true;
 	
-	bool initialize_textures = false;
-
-	if (argc >= 3) {
+	if (argc >= 3)
 		mesh.loadAnimationFrom(argv[2]);
-		initialize_textures = true;
-	}
+
+	// Draws the current pose into a keyframe preview.
+	auto render_preview = [&](TextureToRender* texture) {
+		glViewport(0, 0, preview_width, preview_height);
+		texture->bind();
+		CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
+		if (draw_floor) {
+			floor_pass.setup();
+			// Draw our triangles.
+			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
+				floor_faces.size() * 3,
+				GL_UNSIGNED_INT, 0));
+		}
+
+		// Draw the model
+		if (draw_object) {
+			object_pass.setup();
+			int mid = 0;
+			while (object_pass.renderWithMaterial(mid))
+				mid++;
+#if 0
+			// For debugging also
+			if (mid == 0) // Fallback
+				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3, GL_UNSIGNED_INT, 0));
+#endif
+		}
+		texture->unbind();
+	};
 
 	while (!glfwWindowShouldClose(window)) {
 		// Setup some basic window stuff.
@@ -411,74 +449,44 @@ int main(int argc, char* argv[])
 				<< std::setfill('0') << std::setw(6)
 				<< cur_time << " sec";
 		}
+		gui.updateSaving();
+		if (gui.isSaving())
+			title << " Saving " << int(100.0f * gui.getSaveProgress()) << "%";
 
 		glfwSetWindowTitle(window, title.str().data());
 
-		// FIXME: update the preview textures here
-		if (argc >= 3 && initialize_textures) {
-			glViewport(0, 0, preview_width, preview_height);
-			int i = 0;
-			for (Keyframe* keyframe: mesh.keyframes) {
-				mesh.setPoseFromKeyframe(i);
-				gui.updateMatrices();
-				mats = gui.getMatrixPointers();
-				mesh.updateAnimation();
-				TextureToRender* tex = &(keyframe->texture);
-				tex->bind();
-				CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
-				if (draw_floor) {
-					floor_pass.setup();
-					// Draw our triangles.
-					CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
-						floor_faces.size() * 3,
-						GL_UNSIGNED_INT, 0));
-				}
-				if (draw_object) {
-					object_pass.setup();
-					int mid = 0;
-					while (object_pass.renderWithMaterial(mid))
-						mid++;
-#if 0
-					// For debugging also
-					if (mid == 0) // Fallback
-						CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3, GL_UNSIGNED_INT, 0));
-#endif
-				}
-				tex->unbind();
-				i++;
+		// Previews are made for the rows of the preview bar in view and
+		// given back once scrolled out of it, however long the timeline.
+		int first_row = -gui.current_scroll / preview_height;
+		int end_row = std::min(mesh.timeline.size(),
+		                       (preview_bar_height - gui.current_scroll + preview_height - 1) / preview_height);
+		for (int i = 0; i < mesh.timeline.size(); i++) {
+			if ((i < first_row || i >= end_row) && mesh.timeline.hasPreview(i))
+				mesh.timeline.releasePreview(i);
+		}
+		std::vector<glm::fquat> edited_rot;
+		glm::vec3 edited_trans;
+		for (int i = first_row; i < end_row; i++) {
+			if (mesh.timeline.hasPreview(i))
+				continue;
+			if (edited_rot.empty()) {
+				edited_rot = mesh.skeleton.local_rot;
+				edited_trans = mesh.skeleton.root_trans;
 			}
-			initialize_textures = false;
-			mesh.loadDefaults();
-			gui.updateMatrices();
-			mats = gui.getMatrixPointers();
+			mesh.setPoseFromKeyframe(i);
+			mesh.updateAnimation();
+			TextureToRender* tex = mesh.timeline.preview(i);
+			tex->create(preview_width, preview_height);
+			render_preview(tex);
+		}
+		if (!edited_rot.empty()) {
+			mesh.skeleton.local_rot = edited_rot;
+			mesh.skeleton.root_trans = edited_trans;
+			mesh.skeleton.forwardKinematics();
 			mesh.updateAnimation();
 		}
 		if (gui.getTextureToRender() != nullptr) {
-			TextureToRender* texture = gui.getTextureToRender();
-			glViewport(0, 0, preview_width, preview_height);
-			texture->bind();
-			CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
-			if (draw_floor) {
-				floor_pass.setup();
-				// Draw our triangles.
-				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
-					floor_faces.size() * 3,
-					GL_UNSIGNED_INT, 0));
-			}
-
-			// Draw the model
-			if (draw_object) {
-				object_pass.setup();
-				int mid = 0;
-				while (object_pass.renderWithMaterial(mid))
-					mid++;
-#if 0
-				// For debugging also
-				if (mid == 0) // Fallback
-					CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3, GL_UNSIGNED_INT, 0));
-#endif
-			}
-			texture->unbind();
+			render_preview(gui.getTextureToRender());
 			gui.resetTexture();
 		}
 		glViewport(0, 0, main_view_width, main_view_height);
@@ -496,9 +504,8 @@ int main(int argc, char* argv[])
 		}
 		draw_cylinder = (current_bone != -1 && gui.isTransparent());
 		if (draw_cylinder) {
-			Joint curr_joint = mesh.skeleton.joints[current_bone];
-			glm::vec3 beg_pos = curr_joint.wcoord;
-			glm::vec3 end_pos = curr_joint.position;
+			glm::vec3 beg_pos = mesh.skeleton.jointBegin(current_bone);
+			glm::vec3 end_pos = mesh.skeleton.jointEnd(current_bone);
 			float height = glm::length(end_pos - beg_pos);
 
 			glm::vec3 cylinder_axis = glm::normalize(end_pos - beg_pos);
@@ -590,10 +597,10 @@ int main(int argc, char* argv[])
 
 		// FIXME: Draw previews here, note you need to call glViewport
 		//glBufferData(GL_ARRAY_BUFFER, sizeof(g_quad_vertex_buffer_data), g_quad_vertex_buffer_data, GL_STATIC_DRAW);
-		for (int i = 0; i < mesh.keyframes.size(); i++) {
+		for (int i = first_row; i < end_row; i++) {
 			glViewport(main_view_width, preview_bar_height - (i+1)*preview_height - gui.current_scroll, preview_width, preview_height);
-			Keyframe* keyframe = mesh.keyframes[i];
-			keyframe->texture.bind();
+			TextureToRender* preview = mesh.timeline.preview(i);
+			preview->bind();
 			CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 			//mesh.keyframes[i]->texture.bind();
 			//CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
@@ -604,8 +611,8 @@ int main(int argc, char* argv[])
 				preview_show_border = false;
 			}
 			preview_pass.setup();
-			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3, GL_UNSIGNED_INT, 0));
-			keyframe->texture.unbind();
+			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, preview_faces.size() * 3, GL_UNSIGNED_INT, 0));
+			preview->unbind();
 			//CHECK_GL_ERROR(glDrawElements(GL_PATCHES, preview_faces.size() * 4, GL_UNSIGNED_INT, 0));
 			//mesh.keyframes[i]->texture.unbind();
 		}
@@ -0,0 +1,109 @@
+#include "mapped_file.h"
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	uint64_t rotateLeft(uint64_t x, int bits)
+	{
+		return (x << bits) | (x >> (64 - bits));
+	}
+
+	uint64_t finalMix(uint64_t x)
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
+}
+
+bool MappedFile::open(const std::string& fn)
+{
+	close();
+#ifdef MAPPED_FILE_MMAP
+	int fd = ::open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	if (st.st_size > 0) {
+		void* mapped = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			::close(fd);
+			data_ = static_cast<const char*>(mapped);
+			length_ = size_t(st.st_size);
+			mapped_ = true;
+			open_ = true;
+			return true;
+		}
+	}
+	::close(fd);
+#endif
+	std::ifstream file(fn, std::ios::binary | std::ios::ate);
+	if (!file)
+		return false;
+	buffer_.resize(size_t(file.tellg()));
+	file.seekg(0);
+	file.read(buffer_.data(), buffer_.size());
+	if (!file) {
+		buffer_.clear();
+		return false;
+	}
+	data_ = buffer_.data();
+	length_ = buffer_.size();
+	open_ = true;
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef MAPPED_FILE_MMAP
+	if (mapped_)
+		munmap(const_cast<char*>(data_), length_);
+#endif
+	buffer_.clear();
+	buffer_.shrink_to_fit();
+	open_ = false;
+	mapped_ = false;
+	data_ = nullptr;
+	length_ = 0;
+}
+
+uint64_t hashBytes(const char* data, size_t size)
+{
+	// Four independent lanes over 64-bit words keep several multiplies
+	// in flight, so hashing runs at about memory speed. The tail bytes
+	// go through FNV-1a.
+	const uint64_t kMultiplier = 0x9e3779b97f4a7c15ULL;
+	uint64_t lane[4] = {
+		0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL,
+		0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL
+	};
+	size_t i = 0;
+	for (; i + 4 * sizeof(uint64_t) <= size; i += 4 * sizeof(uint64_t)) {
+		for (int k = 0; k < 4; k++) {
+			uint64_t word;
+			std::memcpy(&word, data + i + k * sizeof(uint64_t), sizeof(word));
+			lane[k] = rotateLeft((lane[k] ^ word) * kMultiplier, 31);
+		}
+	}
+	uint64_t hash = uint64_t(size);
+	for (int k = 0; k < 4; k++)
+		hash = finalMix(hash ^ lane[k]);
+	for (; i < size; i++)
+		hash = (hash ^ uint8_t(data[i])) * 0x100000001b3ULL;
+	return finalMix(hash);
+}
@@ -0,0 +1,43 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only view of a whole file. Where mmap is available the file is
+ * mapped, so the pages are only read as they are touched and are shared
+ * with every other process mapping the same file. Otherwise, or if the
+ * mapping fails, the file is read into memory.
+ */
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	bool open(const std::string& fn); // Quiet, callers report failures
+	void close();
+	bool isOpen() const { return open_; }
+
+	const char* data() const { return data_; }
+	size_t size() const { return length_; }
+
+private:
+	bool open_ = false;
+	bool mapped_ = false;
+	const char* data_ = nullptr;
+	size_t length_ = 0;
+	std::vector<char> buffer_;
+};
+
+/*
+ * Hash of file contents, e.g. of a MappedFile, to tell whether a file
+ * changed or two files are the same. Not cryptographic.
+ */
+uint64_t hashBytes(const char* data, size_t size);
+
+#endif
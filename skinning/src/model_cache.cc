@@ -0,0 +1,460 @@
+#include "model_cache.h"
+#include "bone_geometry.h"
+#include "animation_saver.h"
+#include "mapped_file.h"
+#include "texture_mips.h"
+#include "texture_registry.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <type_traits>
+
+static_assert(sizeof(glm::vec4) == 4 * sizeof(float), "vectors are stored as floats");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "vectors are stored as floats");
+static_assert(sizeof(glm::vec2) == 2 * sizeof(float), "vectors are stored as floats");
+static_assert(sizeof(glm::uvec3) == 3 * sizeof(uint32_t), "faces are stored as 3 indices");
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "matrices are stored as 16 floats");
+
+namespace {
+	const char kMagic[4] = { 'V', 'M', 'D', 'L' };
+	const uint32_t kVersion = 4; // 1 cached textures as RGB, 2 without mips, 3 without joint names
+	const uint64_t kAlignment = 64;
+
+	enum Block {
+		kVertices,
+		kVertexNormals,
+		kUVCoordinates,
+		kFaces,
+		kJoint0,
+		kJoint1,
+		kWeightForJoint0,
+		kVectorFromJoint0,
+		kVectorFromJoint1,
+		kParent,
+		kInitWcoord,
+		kInitPosition,
+		kInitRelPosition,
+		kU,
+		kInverseU,
+		kJointNameEnds,  // Per joint, where its name ends in kJointNameChars
+		kJointNameChars, // The wchar_t of every name, widened to 32 bits
+		kMaterials,
+		kTextures,
+		kNames,
+		kPixels,
+		kNumberOfBlocks
+	};
+
+	struct CacheHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t pmd_hash;
+		int32_t nvertices;
+		int32_t nfaces;
+		int32_t nweights; // Entries of the blend weight arrays
+		int32_t njoints;
+		int32_t nmaterials;
+		int32_t ntextures;
+		float bounds_min[3];
+		float bounds_max[3];
+		uint64_t block_offset[kNumberOfBlocks];
+		uint64_t block_size[kNumberOfBlocks];
+		uint64_t file_size;
+	};
+
+	struct CachedMaterial {
+		glm::vec4 diffuse, ambient, specular;
+		float shininess;
+		int32_t texture; // Into the textures block, -1 for none
+		uint64_t offset;
+		uint64_t nfaces;
+	};
+
+	struct CachedTexture {
+		uint64_t file_hash;
+		int64_t file_size;     // -1 if the file was missing
+		uint64_t name_offset;  // Into the names block
+		uint64_t name_length;
+		uint64_t pixel_offset; // Into the pixels block
+		uint64_t pixel_size;
+		int32_t width;
+		int32_t height;
+		int32_t stride;
+		int32_t loaded;        // 0 if the file could not be decoded
+		int32_t levels;
+		int32_t encoding;      // An ImageEncoding
+	};
+
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + kAlignment - 1) / kAlignment * kAlignment;
+	}
+
+	/*
+	 * Where every block goes for the counts in header.
+	 */
+	void layout(CacheHeader& header, uint64_t names_size, uint64_t joint_names_size, uint64_t pixels_size)
+	{
+		uint64_t nvertices = uint64_t(header.nvertices);
+		uint64_t nweights = uint64_t(header.nweights);
+		uint64_t njoints = uint64_t(header.njoints);
+		uint64_t* size = header.block_size;
+		size[kVertices] = nvertices * sizeof(glm::vec4);
+		size[kVertexNormals] = nvertices * sizeof(glm::vec4);
+		size[kUVCoordinates] = nvertices * sizeof(glm::vec2);
+		size[kFaces] = uint64_t(header.nfaces) * sizeof(glm::uvec3);
+		size[kJoint0] = nweights * sizeof(int32_t);
+		size[kJoint1] = nweights * sizeof(int32_t);
+		size[kWeightForJoint0] = nweights * sizeof(float);
+		size[kVectorFromJoint0] = nweights * sizeof(glm::vec3);
+		size[kVectorFromJoint1] = nweights * sizeof(glm::vec3);
+		size[kParent] = njoints * sizeof(int32_t);
+		size[kInitWcoord] = njoints * sizeof(glm::vec3);
+		size[kInitPosition] = njoints * sizeof(glm::vec3);
+		size[kInitRelPosition] = njoints * sizeof(glm::vec3);
+		size[kU] = njoints * sizeof(glm::mat4);
+		size[kInverseU] = njoints * sizeof(glm::mat4);
+		size[kJointNameEnds] = njoints * sizeof(uint64_t);
+		size[kJointNameChars] = joint_names_size;
+		size[kMaterials] = uint64_t(header.nmaterials) * sizeof(CachedMaterial);
+		size[kTextures] = uint64_t(header.ntextures) * sizeof(CachedTexture);
+		size[kNames] = names_size;
+		size[kPixels] = pixels_size;
+		uint64_t offset = alignUp(sizeof(CacheHeader));
+		for (int b = 0; b < kNumberOfBlocks; b++) {
+			header.block_offset[b] = offset;
+			offset = alignUp(offset + size[b]);
+		}
+		header.file_size = header.block_offset[kPixels] + pixels_size;
+	}
+
+	template<typename T>
+	const T* block(const MappedFile& file, const CacheHeader& header, Block b)
+	{
+		return reinterpret_cast<const T*>(file.data() + header.block_offset[b]);
+	}
+
+	template<typename Vector>
+	void copyBlock(Vector& v, const MappedFile& file, const CacheHeader& header, Block b)
+	{
+		typedef typename Vector::value_type T;
+		const T* begin = block<T>(file, header, b);
+		v.assign(begin, begin + header.block_size[b] / sizeof(T));
+	}
+
+	/*
+	 * A missing file hashes to 0 with a size of -1.
+	 */
+	void hashFile(const std::string& fn, uint64_t& hash, int64_t& size)
+	{
+		MappedFile file;
+		if (!file.open(fn)) {
+			hash = 0;
+			size = -1;
+			return;
+		}
+		hash = hashBytes(file.data(), file.size());
+		size = int64_t(file.size());
+	}
+}
+
+std::string modelCacheFile(const std::string& pmd_file)
+{
+	return pmd_file + ".cache";
+}
+
+bool loadModelCache(const std::string& pmd_file, Mesh& mesh)
+{
+	MappedFile file;
+	if (!file.open(modelCacheFile(pmd_file)) || file.size() < sizeof(CacheHeader))
+		return false;
+	const CacheHeader& header = *reinterpret_cast<const CacheHeader*>(file.data());
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+	    header.nvertices < 0 || header.nfaces < 0 || header.nweights < 0 ||
+	    header.njoints < 0 || header.nmaterials < 0 || header.ntextures < 0)
+		return false;
+	CacheHeader expected = header;
+	layout(expected, header.block_size[kNames], header.block_size[kJointNameChars], header.block_size[kPixels]);
+	if (std::memcmp(expected.block_offset, header.block_offset, sizeof(header.block_offset)) != 0 ||
+	    std::memcmp(expected.block_size, header.block_size, sizeof(header.block_size)) != 0 ||
+	    expected.file_size != header.file_size || header.file_size > file.size())
+		return false;
+
+	MappedFile pmd;
+	if (!pmd.open(pmd_file) || hashBytes(pmd.data(), pmd.size()) != header.pmd_hash)
+		return false;
+
+	// Check everything before the mesh is touched.
+	const CachedTexture* textures = block<CachedTexture>(file, header, kTextures);
+	const char* names = block<char>(file, header, kNames);
+	const unsigned char* pixels = block<unsigned char>(file, header, kPixels);
+	uint64_t names_size = header.block_size[kNames];
+	uint64_t pixels_size = header.block_size[kPixels];
+	std::vector<std::shared_ptr<Image>> images(header.ntextures);
+	for (int t = 0; t < header.ntextures; t++) {
+		const CachedTexture& texture = textures[t];
+		if (texture.name_offset > names_size || texture.name_length > names_size - texture.name_offset ||
+		    texture.pixel_offset > pixels_size || texture.pixel_size > pixels_size - texture.pixel_offset)
+			return false;
+		uint64_t hash;
+		int64_t size;
+		hashFile(std::string(names + texture.name_offset, texture.name_length), hash, size);
+		if (hash != texture.file_hash || size != texture.file_size)
+			return false;
+		if (!texture.loaded)
+			continue;
+		// Textures compressed or not as the registry would load them now.
+		TextureRegistry& registry = TextureRegistry::instance();
+		bool compressed = texture.encoding == kImageBC1 || texture.encoding == kImageBC3;
+		if ((texture.encoding != kImagePixels && !compressed) || compressed != registry.compression() ||
+		    texture.width <= 0 || texture.height <= 0 ||
+		    texture.levels != numberOfMipLevels(texture.width, texture.height) ||
+		    texture.pixel_size != mipChainSize(ImageEncoding(texture.encoding), texture.width,
+		                                       texture.height, texture.levels))
+			return false;
+		// A texture some other model uses is not copied again.
+		images[t] = registry.find(texture.file_hash, uint64_t(texture.file_size));
+		if (images[t])
+			continue;
+		auto image = std::make_shared<Image>();
+		image->width = texture.width;
+		image->height = texture.height;
+		image->stride = texture.stride;
+		image->levels = texture.levels;
+		image->encoding = ImageEncoding(texture.encoding);
+		image->bytes.assign(pixels + texture.pixel_offset,
+		                    pixels + texture.pixel_offset + texture.pixel_size);
+		images[t] = registry.share(texture.file_hash, uint64_t(texture.file_size), image);
+	}
+	// Materials draw runs of the faces.
+	const CachedMaterial* materials = block<CachedMaterial>(file, header, kMaterials);
+	uint64_t nfaces = uint64_t(header.nfaces);
+	for (int i = 0; i < header.nmaterials; i++)
+		if (materials[i].texture < -1 || materials[i].texture >= header.ntextures ||
+		    materials[i].offset > nfaces || materials[i].nfaces > nfaces - materials[i].offset)
+			return false;
+	const glm::uvec3* faces = block<glm::uvec3>(file, header, kFaces);
+	for (int i = 0; i < header.nfaces; i++)
+		if (faces[i][0] >= uint32_t(header.nvertices) || faces[i][1] >= uint32_t(header.nvertices) ||
+		    faces[i][2] >= uint32_t(header.nvertices))
+			return false;
+	// Every blend weight names a joint, the second one may be -1.
+	const int32_t* joint0 = block<int32_t>(file, header, kJoint0);
+	const int32_t* joint1 = block<int32_t>(file, header, kJoint1);
+	for (int i = 0; i < header.nweights; i++)
+		if (joint0[i] < 0 || joint0[i] >= header.njoints || joint1[i] < -1 || joint1[i] >= header.njoints)
+			return false;
+	// addJoint only ever appends children of joints it already has.
+	const int32_t* parent = block<int32_t>(file, header, kParent);
+	for (int id = 0; id < header.njoints; id++)
+		if (parent[id] < -1 || parent[id] >= id)
+			return false;
+	const uint64_t* name_ends = block<uint64_t>(file, header, kJointNameEnds);
+	const uint32_t* name_chars = block<uint32_t>(file, header, kJointNameChars);
+	uint64_t nchars = header.block_size[kJointNameChars] / sizeof(uint32_t);
+	if (header.block_size[kJointNameChars] % sizeof(uint32_t) != 0 ||
+	    (header.njoints > 0 && name_ends[header.njoints - 1] != nchars) ||
+	    (header.njoints == 0 && nchars != 0))
+		return false;
+	for (int id = 1; id < header.njoints; id++)
+		if (name_ends[id] < name_ends[id - 1])
+			return false;
+
+	copyBlock(mesh.vertices, file, header, kVertices);
+	copyBlock(mesh.vertex_normals, file, header, kVertexNormals);
+	copyBlock(mesh.uv_coordinates, file, header, kUVCoordinates);
+	copyBlock(mesh.faces, file, header, kFaces);
+	copyBlock(mesh.joint0, file, header, kJoint0);
+	copyBlock(mesh.joint1, file, header, kJoint1);
+	copyBlock(mesh.weight_for_joint0, file, header, kWeightForJoint0);
+	copyBlock(mesh.vector_from_joint0, file, header, kVectorFromJoint0);
+	copyBlock(mesh.vector_from_joint1, file, header, kVectorFromJoint1);
+	mesh.bounds.min = glm::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+	mesh.bounds.max = glm::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+
+	mesh.materials.resize(header.nmaterials);
+	for (int i = 0; i < header.nmaterials; i++) {
+		Material& ma = mesh.materials[i];
+		ma.diffuse = materials[i].diffuse;
+		ma.ambient = materials[i].ambient;
+		ma.specular = materials[i].specular;
+		ma.shininess = materials[i].shininess;
+		ma.offset = size_t(materials[i].offset);
+		ma.nfaces = size_t(materials[i].nfaces);
+		ma.texture = materials[i].texture >= 0 ? images[materials[i].texture] : nullptr;
+	}
+
+	// The same state addJoint leaves behind, then the same topology and
+	// pose as a parsed model.
+	Skeleton& skeleton = mesh.skeleton;
+	skeleton = Skeleton();
+	copyBlock(skeleton.parent, file, header, kParent);
+	copyBlock(skeleton.init_wcoord, file, header, kInitWcoord);
+	copyBlock(skeleton.init_position, file, header, kInitPosition);
+	copyBlock(skeleton.init_rel_position, file, header, kInitRelPosition);
+	copyBlock(skeleton.U, file, header, kU);
+	copyBlock(skeleton.inverse_U, file, header, kInverseU);
+	skeleton.local_rot.assign(header.njoints, glm::fquat(1.0f, 0.0f, 0.0f, 0.0f));
+	skeleton.world_rot = skeleton.local_rot;
+	skeleton.world_trans = skeleton.init_wcoord;
+	skeleton.buildTopology();
+	skeleton.forwardKinematics();
+
+	mesh.joint_names.resize(header.njoints);
+	for (int id = 0; id < header.njoints; id++) {
+		uint64_t begin = id > 0 ? name_ends[id - 1] : 0;
+		mesh.joint_names[id].assign(name_chars + begin, name_chars + name_ends[id]);
+	}
+	return true;
+}
+
+bool saveModelCache(const std::string& pmd_file, const Mesh& mesh,
+                    const std::vector<std::string>& texture_files)
+{
+	const Skeleton& skeleton = mesh.skeleton;
+	size_t nvertices = mesh.vertices.size();
+	size_t nweights = mesh.joint0.size();
+	if (mesh.vertex_normals.size() != nvertices || mesh.uv_coordinates.size() != nvertices ||
+	    mesh.joint1.size() != nweights || mesh.weight_for_joint0.size() != nweights ||
+	    mesh.vector_from_joint0.size() != nweights || mesh.vector_from_joint1.size() != nweights) {
+		std::cerr << "Not caching " << pmd_file << ", its vertex attributes differ in size" << std::endl;
+		return false;
+	}
+	MappedFile pmd;
+	if (!pmd.open(pmd_file))
+		return false;
+
+	CacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.pmd_hash = hashBytes(pmd.data(), pmd.size());
+	pmd.close();
+	header.nvertices = int32_t(nvertices);
+	header.nfaces = int32_t(mesh.faces.size());
+	header.nweights = int32_t(nweights);
+	header.njoints = skeleton.getNumberOfJoints();
+	header.nmaterials = int32_t(mesh.materials.size());
+	for (int k = 0; k < 3; k++) {
+		header.bounds_min[k] = mesh.bounds.min[k];
+		header.bounds_max[k] = mesh.bounds.max[k];
+	}
+
+	// Materials sharing a texture file share its record, as they share
+	// the Image.
+	std::vector<CachedMaterial> materials(mesh.materials.size());
+	std::vector<CachedTexture> textures;
+	std::vector<const Image*> images;
+	std::map<std::string, int> texture_index;
+	std::string names;
+	uint64_t pixels_size = 0;
+	for (size_t i = 0; i < materials.size(); i++) {
+		const Material& ma = mesh.materials[i];
+		CachedMaterial& cached = materials[i];
+		cached.diffuse = ma.diffuse;
+		cached.ambient = ma.ambient;
+		cached.specular = ma.specular;
+		cached.shininess = ma.shininess;
+		cached.texture = -1;
+		cached.offset = ma.offset;
+		cached.nfaces = ma.nfaces;
+		if (i >= texture_files.size() || texture_files[i].empty())
+			continue;
+		const std::string& name = texture_files[i];
+		auto iter = texture_index.find(name);
+		if (iter == texture_index.end()) {
+			CachedTexture texture;
+			std::memset(&texture, 0, sizeof(texture));
+			hashFile(name, texture.file_hash, texture.file_size);
+			texture.name_offset = names.size();
+			texture.name_length = name.size();
+			names += name;
+			const Image* image = ma.texture.get();
+			if (image) {
+				texture.pixel_offset = pixels_size;
+				texture.pixel_size = image->bytes.size();
+				texture.width = image->width;
+				texture.height = image->height;
+				texture.stride = image->stride;
+				texture.loaded = 1;
+				texture.levels = image->levels;
+				texture.encoding = image->encoding;
+				pixels_size = alignUp(pixels_size + texture.pixel_size);
+			}
+			iter = texture_index.emplace(name, int(textures.size())).first;
+			textures.push_back(texture);
+			images.push_back(image);
+		}
+		cached.texture = iter->second;
+	}
+	header.ntextures = int32_t(textures.size());
+
+	std::vector<uint64_t> joint_name_ends(skeleton.getNumberOfJoints(), 0);
+	std::vector<uint32_t> joint_name_chars;
+	for (size_t id = 0; id < joint_name_ends.size(); id++) {
+		if (id < mesh.joint_names.size())
+			joint_name_chars.insert(joint_name_chars.end(), mesh.joint_names[id].begin(),
+			                        mesh.joint_names[id].end());
+		joint_name_ends[id] = joint_name_chars.size();
+	}
+	layout(header, names.size(), joint_name_chars.size() * sizeof(uint32_t), pixels_size);
+
+	// Another process may be writing the same cache, so the temporary
+	// name is our own.
+	std::string fn = modelCacheFile(pmd_file);
+	std::string tmp = fn + ".tmp" + std::to_string(std::random_device()());
+	std::ofstream file(tmp, std::ios::binary);
+	if (!file) {
+		std::cerr << "Cannot write model cache " << fn << std::endl;
+		return false;
+	}
+	const char padding[kAlignment] = {};
+	auto pad = [&file, &padding](uint64_t offset) {
+		file.write(padding, std::streamsize(offset - uint64_t(file.tellp())));
+	};
+	auto put = [&file, &header, &pad](Block b, const void* data) {
+		pad(header.block_offset[b]);
+		file.write(static_cast<const char*>(data), std::streamsize(header.block_size[b]));
+	};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	put(kVertices, mesh.vertices.data());
+	put(kVertexNormals, mesh.vertex_normals.data());
+	put(kUVCoordinates, mesh.uv_coordinates.data());
+	put(kFaces, mesh.faces.data());
+	put(kJoint0, mesh.joint0.data());
+	put(kJoint1, mesh.joint1.data());
+	put(kWeightForJoint0, mesh.weight_for_joint0.data());
+	put(kVectorFromJoint0, mesh.vector_from_joint0.data());
+	put(kVectorFromJoint1, mesh.vector_from_joint1.data());
+	std::vector<int32_t> parent(skeleton.parent.begin(), skeleton.parent.end());
+	put(kParent, parent.data());
+	put(kInitWcoord, skeleton.init_wcoord.data());
+	put(kInitPosition, skeleton.init_position.data());
+	put(kInitRelPosition, skeleton.init_rel_position.data());
+	put(kU, skeleton.U.data());
+	put(kInverseU, skeleton.inverse_U.data());
+	put(kJointNameEnds, joint_name_ends.data());
+	put(kJointNameChars, joint_name_chars.data());
+	put(kMaterials, materials.data());
+	put(kTextures, textures.data());
+	put(kNames, names.data());
+	for (size_t t = 0; t < textures.size(); t++) {
+		if (!images[t])
+			continue;
+		pad(header.block_offset[kPixels] + textures[t].pixel_offset);
+		file.write(reinterpret_cast<const char*>(images[t]->bytes.data()),
+		           std::streamsize(textures[t].pixel_size));
+	}
+	pad(header.file_size);
+	file.close();
+	if (!file) {
+		std::cerr << "Cannot write model cache " << fn << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return replaceFile(tmp, fn);
+}
@@ -0,0 +1,47 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <string>
+#include <vector>
+
+struct Mesh;
+
+/*
+ * Everything Mesh::loadPmd derives from a PMD file and its textures,
+ * kept next to it as fn + ".cache" in native byte order:
+ *
+ *      header      counts, bounds, the hash of the PMD and a block table
+ *      vertex attributes, faces and blend weights, one block per array
+ *      joint arrays: parent, rest pose, U, inverse_U and the ends of
+ *                  the joint names, then the names
+ *      materials   one record per material, naming its texture by index
+ *      textures    one record per texture file: its hash, size, name
+ *                  and the mip chain of the Image read from it, block
+ *                  compressed if the TextureRegistry compresses
+ *      names, pixels
+ *
+ * Every block starts at a multiple of 64 bytes, so the mapped file is a
+ * set of arrays copied into the Mesh as they are. The cache is only used
+ * while the PMD and every texture file hash to what they did when it was
+ * written; a missing texture file counts, so one appearing later
+ * invalidates the cache too. So does turning texture compression on or
+ * off.
+ */
+std::string modelCacheFile(const std::string& pmd_file);
+
+/*
+ * Fills a freshly constructed mesh from the cache of pmd_file. Returns
+ * false, quietly and with the mesh untouched, if there is no valid cache.
+ * The timeline is left alone.
+ */
+bool loadModelCache(const std::string& pmd_file, Mesh& mesh);
+
+/*
+ * Writes the cache of a mesh just loaded from pmd_file. texture_files
+ * names the texture file of each material, as MMDReader::getMaterial
+ * reports them.
+ */
+bool saveModelCache(const std::string& pmd_file, const Mesh& mesh,
+                    const std::vector<std::string>& texture_files);
+
+#endif
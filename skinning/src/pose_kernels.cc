@@ -0,0 +1,414 @@
+#include "pose_kernels.h"
+#include <cmath>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/*
+ * One register holding the same component of kLanes joints.
+ */
+#if defined(__AVX2__)
+
+constexpr int kLanes = 8;
+struct Lanes { __m256 v; };
+
+inline Lanes set1(float f) { return { _mm256_set1_ps(f) }; }
+inline Lanes load(const float* p) { return { _mm256_load_ps(p) }; }
+inline void store(float* p, Lanes a) { _mm256_store_ps(p, a.v); }
+inline Lanes operator+(Lanes a, Lanes b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline Lanes operator*(Lanes a, Lanes b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline Lanes operator/(Lanes a, Lanes b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline Lanes sqrt(Lanes a) { return { _mm256_sqrt_ps(a.v) }; }
+inline Lanes min(Lanes a, Lanes b) { return { _mm256_min_ps(a.v, b.v) }; }
+/* -1 where a < 0, 1 elsewhere */
+inline Lanes signOf(Lanes a)
+{
+	__m256 neg = _mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_LT_OQ);
+	return { _mm256_blendv_ps(_mm256_set1_ps(1.0f), _mm256_set1_ps(-1.0f), neg) };
+}
+/* x where a < b, y elsewhere */
+inline Lanes selectLess(Lanes a, Lanes b, Lanes x, Lanes y)
+{
+	return { _mm256_blendv_ps(y.v, x.v, _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)) };
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+constexpr int kLanes = 4;
+struct Lanes { __m128 v; };
+
+inline Lanes set1(float f) { return { _mm_set1_ps(f) }; }
+inline Lanes load(const float* p) { return { _mm_load_ps(p) }; }
+inline void store(float* p, Lanes a) { _mm_store_ps(p, a.v); }
+inline Lanes operator+(Lanes a, Lanes b) { return { _mm_add_ps(a.v, b.v) }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline Lanes operator*(Lanes a, Lanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline Lanes operator/(Lanes a, Lanes b) { return { _mm_div_ps(a.v, b.v) }; }
+inline Lanes sqrt(Lanes a) { return { _mm_sqrt_ps(a.v) }; }
+inline Lanes min(Lanes a, Lanes b) { return { _mm_min_ps(a.v, b.v) }; }
+inline Lanes signOf(Lanes a)
+{
+	__m128 neg = _mm_cmplt_ps(a.v, _mm_setzero_ps());
+	__m128 sign_bit = _mm_and_ps(neg, _mm_set1_ps(-0.0f));
+	return { _mm_or_ps(_mm_set1_ps(1.0f), sign_bit) };
+}
+inline Lanes selectLess(Lanes a, Lanes b, Lanes x, Lanes y)
+{
+	__m128 less = _mm_cmplt_ps(a.v, b.v);
+	return { _mm_or_ps(_mm_and_ps(less, x.v), _mm_andnot_ps(less, y.v)) };
+}
+
+#else
+
+constexpr int kLanes = 1;
+struct Lanes { float v; };
+
+inline Lanes set1(float f) { return { f }; }
+inline Lanes load(const float* p) { return { *p }; }
+inline void store(float* p, Lanes a) { *p = a.v; }
+inline Lanes operator+(Lanes a, Lanes b) { return { a.v + b.v }; }
+inline Lanes operator-(Lanes a, Lanes b) { return { a.v - b.v }; }
+inline Lanes operator*(Lanes a, Lanes b) { return { a.v * b.v }; }
+inline Lanes operator/(Lanes a, Lanes b) { return { a.v / b.v }; }
+inline Lanes sqrt(Lanes a) { return { std::sqrt(a.v) }; }
+inline Lanes min(Lanes a, Lanes b) { return { a.v < b.v ? a.v : b.v }; }
+inline Lanes signOf(Lanes a) { return { a.v < 0.0f ? -1.0f : 1.0f }; }
+inline Lanes selectLess(Lanes a, Lanes b, Lanes x, Lanes y) { return { a.v < b.v ? x.v : y.v }; }
+
+#endif
+
+/*
+ * Transposed quaternions and vectors. Lanes past the end of the input are
+ * padded with the identity and never stored.
+ */
+struct QuatLanes { Lanes x, y, z, w; };
+struct VecLanes { Lanes x, y, z; };
+
+struct alignas(32) Scratch {
+	float c[4][kLanes];
+};
+
+inline size_t lanesIn(size_t begin, size_t n)
+{
+	return n - begin < size_t(kLanes) ? n - begin : size_t(kLanes);
+}
+
+template<typename Index>
+QuatLanes loadQuats(const glm::fquat* q, Index index, size_t count)
+{
+	Scratch s;
+	for (int l = 0; l < kLanes; l++) {
+		glm::fquat v = size_t(l) < count ? q[index(l)] : glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
+		s.c[0][l] = v.x;
+		s.c[1][l] = v.y;
+		s.c[2][l] = v.z;
+		s.c[3][l] = v.w;
+	}
+	return { load(s.c[0]), load(s.c[1]), load(s.c[2]), load(s.c[3]) };
+}
+
+template<typename Index>
+void storeQuats(glm::fquat* q, Index index, size_t count, const QuatLanes& v)
+{
+	Scratch s;
+	store(s.c[0], v.x);
+	store(s.c[1], v.y);
+	store(s.c[2], v.z);
+	store(s.c[3], v.w);
+	for (size_t l = 0; l < count; l++)
+		q[index(l)] = glm::fquat(s.c[3][l], s.c[0][l], s.c[1][l], s.c[2][l]);
+}
+
+inline Lanes loadFloats(const float* p, size_t begin, size_t count)
+{
+	Scratch s;
+	for (int l = 0; l < kLanes; l++)
+		s.c[0][l] = size_t(l) < count ? p[begin + l] : 0.0f;
+	return load(s.c[0]);
+}
+
+inline void storeFloats(float* p, size_t begin, size_t count, Lanes v)
+{
+	Scratch s;
+	store(s.c[0], v);
+	for (size_t l = 0; l < count; l++)
+		p[begin + l] = s.c[0][l];
+}
+
+template<typename Index>
+VecLanes loadVecs(const glm::vec3* p, Index index, size_t count)
+{
+	Scratch s;
+	for (int l = 0; l < kLanes; l++) {
+		glm::vec3 v = size_t(l) < count ? p[index(l)] : glm::vec3(0.0f);
+		s.c[0][l] = v.x;
+		s.c[1][l] = v.y;
+		s.c[2][l] = v.z;
+	}
+	return { load(s.c[0]), load(s.c[1]), load(s.c[2]) };
+}
+
+template<typename Index>
+void storeVecs(glm::vec3* p, Index index, size_t count, const VecLanes& v)
+{
+	Scratch s;
+	store(s.c[0], v.x);
+	store(s.c[1], v.y);
+	store(s.c[2], v.z);
+	for (size_t l = 0; l < count; l++)
+		p[index(l)] = glm::vec3(s.c[0][l], s.c[1][l], s.c[2][l]);
+}
+
+struct Contiguous {
+	size_t begin;
+	size_t operator()(size_t l) const { return begin + l; }
+};
+
+struct Gathered {
+	const int* ids;
+	size_t operator()(size_t l) const { return ids[l]; }
+};
+
+inline Lanes dot(const QuatLanes& a, const QuatLanes& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+inline QuatLanes scale(const QuatLanes& q, Lanes s)
+{
+	return { q.x * s, q.y * s, q.z * s, q.w * s };
+}
+
+inline QuatLanes add(const QuatLanes& a, const QuatLanes& b)
+{
+	return { a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w };
+}
+
+inline QuatLanes normalize(const QuatLanes& q)
+{
+	return scale(q, set1(1.0f) / sqrt(dot(q, q)));
+}
+
+/* Hamilton product p * q, same convention as glm */
+inline QuatLanes multiply(const QuatLanes& p, const QuatLanes& q)
+{
+	return {
+		p.w * q.x + p.x * q.w + p.y * q.z - p.z * q.y,
+		p.w * q.y + p.y * q.w + p.z * q.x - p.x * q.z,
+		p.w * q.z + p.z * q.w + p.x * q.y - p.y * q.x,
+		p.w * q.w - p.x * q.x - p.y * q.y - p.z * q.z
+	};
+}
+
+inline VecLanes cross(Lanes ax, Lanes ay, Lanes az, const VecLanes& b)
+{
+	return { ay * b.z - az * b.y, az * b.x - ax * b.z, ax * b.y - ay * b.x };
+}
+
+/* q * v for unit q, v + 2w(u x v) + 2u x (u x v) */
+inline VecLanes rotate(const QuatLanes& q, const VecLanes& v)
+{
+	VecLanes t = cross(q.x, q.y, q.z, v);
+	Lanes two = set1(2.0f);
+	t = { t.x * two, t.y * two, t.z * two };
+	VecLanes u = cross(q.x, q.y, q.z, t);
+	return { v.x + q.w * t.x + u.x, v.y + q.w * t.y + u.y, v.z + q.w * t.z + u.z };
+}
+
+/*
+ * Slerp weights without trigonometry, from Eberly's "A Fast and Accurate
+ * Algorithm for Computing SLERP". x = cos(theta) must be in [0, 1].
+ * Returns the weight of the end point for parameter t; the weight of the
+ * start point is the same series evaluated at 1 - t.
+ */
+inline Lanes slerpWeight(Lanes t, Lanes x_minus_one)
+{
+	static const float one_plus_mu = 1.90110745351730037f;
+	static const float u[8] = {
+		1.0f / (1 * 3), 1.0f / (2 * 5), 1.0f / (3 * 7), 1.0f / (4 * 9),
+		1.0f / (5 * 11), 1.0f / (6 * 13), 1.0f / (7 * 15), one_plus_mu / (8 * 17)
+	};
+	static const float v[8] = {
+		1.0f / 3, 2.0f / 5, 3.0f / 7, 4.0f / 9,
+		5.0f / 11, 6.0f / 13, 7.0f / 15, one_plus_mu * 8 / 17
+	};
+	Lanes t2 = t * t;
+	Lanes one = set1(1.0f);
+	Lanes f = one;
+	for (int i = 7; i >= 0; i--)
+		f = one + (set1(u[i]) * t2 - set1(v[i])) * x_minus_one * f;
+	return t * f;
+}
+
+}
+
+const char* poseKernelIsa()
+{
+#if defined(__AVX2__)
+	return "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void quatNormalizeBatch(glm::fquat* q, size_t n)
+{
+	// Normalizing rounds again, which can move a unit quaternion by an ulp.
+	// Ones whose squared length is within rounding of 1 are kept as is.
+	Lanes one = set1(1.0f);
+	Lanes rounding = set1(std::ldexp(1.0f, -40)); // (16 ulp)^2
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		QuatLanes v = loadQuats(q, Contiguous{i}, count);
+		Lanes d = dot(v, v);
+		Lanes s = selectLess((d - one) * (d - one), rounding, one, one / sqrt(d));
+		storeQuats(q, Contiguous{i}, count, scale(v, s));
+	}
+}
+
+void quatNlerpBatch(const glm::fquat* a, const glm::fquat* b, float t, glm::fquat* out, size_t n)
+{
+	Lanes wb = set1(t);
+	Lanes wa = set1(1.0f - t);
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		QuatLanes qa = loadQuats(a, Contiguous{i}, count);
+		QuatLanes qb = loadQuats(b, Contiguous{i}, count);
+		Lanes sign = signOf(dot(qa, qb));
+		QuatLanes r = add(scale(qa, wa), scale(qb, wb * sign));
+		storeQuats(out, Contiguous{i}, count, normalize(r));
+	}
+}
+
+void quatSlerpBatch(const glm::fquat* a, const glm::fquat* b, float t, glm::fquat* out, size_t n)
+{
+	Lanes tb = set1(t);
+	Lanes ta = set1(1.0f - t);
+	Lanes one = set1(1.0f);
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		QuatLanes qa = loadQuats(a, Contiguous{i}, count);
+		QuatLanes qb = loadQuats(b, Contiguous{i}, count);
+		Lanes d = dot(qa, qb);
+		Lanes sign = signOf(d);
+		/* clamp rounding on nearly equal keys so x stays in [0, 1] */
+		Lanes x = min(d * sign - one, set1(0.0f));
+		QuatLanes r = add(scale(qa, slerpWeight(ta, x)),
+		                  scale(qb, slerpWeight(tb, x) * sign));
+		storeQuats(out, Contiguous{i}, count, r);
+	}
+}
+
+void prepareSlerpBatch(const glm::fquat* a, const glm::fquat* b,
+                       glm::fquat* b_aligned, float* cos_minus_one, size_t n)
+{
+	Lanes one = set1(1.0f);
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		QuatLanes qa = normalize(loadQuats(a, Contiguous{i}, count));
+		QuatLanes qb = normalize(loadQuats(b, Contiguous{i}, count));
+		Lanes d = dot(qa, qb);
+		Lanes sign = signOf(d);
+		storeQuats(b_aligned, Contiguous{i}, count, scale(qb, sign));
+		storeFloats(cos_minus_one, i, count, min(d * sign - one, set1(0.0f)));
+	}
+}
+
+void quatSlerpPreparedBatch(const glm::fquat* a, const glm::fquat* b_aligned,
+                            const float* cos_minus_one, float t, glm::fquat* out, size_t n)
+{
+	Lanes tb = set1(t);
+	Lanes ta = set1(1.0f - t);
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		QuatLanes qa = loadQuats(a, Contiguous{i}, count);
+		QuatLanes qb = loadQuats(b_aligned, Contiguous{i}, count);
+		Lanes x = loadFloats(cos_minus_one, i, count);
+		QuatLanes r = add(scale(qa, slerpWeight(ta, x)), scale(qb, slerpWeight(tb, x)));
+		storeQuats(out, Contiguous{i}, count, r);
+	}
+}
+
+void quatToAffineBatch(const glm::fquat* rot, const glm::vec3* trans, glm::mat4* out, size_t n)
+{
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		QuatLanes q = loadQuats(rot, Contiguous{i}, count);
+		VecLanes p = loadVecs(trans, Contiguous{i}, count);
+		Lanes one = set1(1.0f);
+		Lanes two = set1(2.0f);
+		Lanes xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		Lanes xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		Lanes wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+		/* column major, same layout as glm::mat3_cast */
+		Lanes m[12] = {
+			one - two * (yy + zz), two * (xy + wz), two * (xz - wy),
+			two * (xy - wz), one - two * (xx + zz), two * (yz + wx),
+			two * (xz + wy), two * (yz - wx), one - two * (xx + yy),
+			p.x, p.y, p.z
+		};
+		alignas(32) float s[12][kLanes];
+		for (int k = 0; k < 12; k++)
+			store(s[k], m[k]);
+		for (size_t l = 0; l < count; l++) {
+			glm::mat4& o = out[i + l];
+			for (int c = 0; c < 4; c++) {
+				o[c] = glm::vec4(s[c * 3][l], s[c * 3 + 1][l], s[c * 3 + 2][l],
+				                 c == 3 ? 1.0f : 0.0f);
+			}
+		}
+	}
+}
+
+void mat4MultiplyBatch(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+#if defined(__SSE2__) || defined(_M_X64)
+		/* one matrix per iteration, a column of the result per register */
+		__m128 ac[4], rc[4];
+		for (int k = 0; k < 4; k++)
+			ac[k] = _mm_loadu_ps(&a[i][k][0]);
+		for (int c = 0; c < 4; c++) {
+			const float* bc = &b[i][c][0];
+			__m128 r = _mm_mul_ps(ac[0], _mm_set1_ps(bc[0]));
+			r = _mm_add_ps(r, _mm_mul_ps(ac[1], _mm_set1_ps(bc[1])));
+			r = _mm_add_ps(r, _mm_mul_ps(ac[2], _mm_set1_ps(bc[2])));
+			r = _mm_add_ps(r, _mm_mul_ps(ac[3], _mm_set1_ps(bc[3])));
+			rc[c] = r;
+		}
+		for (int c = 0; c < 4; c++)
+			_mm_storeu_ps(&out[i][c][0], rc[c]);
+#else
+		out[i] = a[i] * b[i];
+#endif
+	}
+}
+
+void composeAffineBatch(const int* ids, size_t n, const int* parent,
+                        const glm::fquat* local_rot, const glm::vec3* local_trans,
+                        glm::fquat* world_rot, glm::vec3* world_trans)
+{
+	int parent_ids[kLanes];
+	for (size_t i = 0; i < n; i += kLanes) {
+		size_t count = lanesIn(i, n);
+		for (size_t l = 0; l < count; l++)
+			parent_ids[l] = parent[ids[i + l]];
+		Gathered self{ids + i}, up{parent_ids};
+		QuatLanes parent_rot = loadQuats(world_rot, up, count);
+		VecLanes parent_trans = loadVecs(world_trans, up, count);
+		QuatLanes rot = loadQuats(local_rot, self, count);
+		VecLanes offset = rotate(parent_rot, loadVecs(local_trans, self, count));
+		storeQuats(world_rot, self, count, multiply(parent_rot, rot));
+		storeVecs(world_trans, self, count, VecLanes{
+			parent_trans.x + offset.x,
+			parent_trans.y + offset.y,
+			parent_trans.z + offset.z
+		});
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef POSE_KERNELS_H
+#define POSE_KERNELS_H
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/*
+ * Batched pose math over arrays of joints.
+ *
+ * Each kernel works on 8 (AVX2), 4 (SSE2) or 1 (scalar fallback) joints at
+ * a time. The instruction set is chosen at compile time, see
+ * cmake/simd.cmake. Quaternions are transposed into one register per
+ * component, so every instruction handles one component of several joints.
+ *
+ * Results match the glm equivalents to float rounding, except slerp which
+ * uses a polynomial instead of acos/sin. It is within 1e-6 of glm::slerp
+ * for keys up to 110 degrees apart and within 4e-5 near 180 degrees.
+ */
+
+const char* poseKernelIsa();
+
+/*
+ * Leaves quaternions that are unit length to float rounding unchanged, so
+ * normalizing twice gives the same bits as normalizing once.
+ */
+void quatNormalizeBatch(glm::fquat* q, size_t n);
+
+/*
+ * Shortest path interpolation from a[i] to b[i], like glm::slerp.
+ * out may alias a or b.
+ */
+void quatNlerpBatch(const glm::fquat* a, const glm::fquat* b, float t, glm::fquat* out, size_t n);
+void quatSlerpBatch(const glm::fquat* a, const glm::fquat* b, float t, glm::fquat* out, size_t n);
+
+/*
+ * Splits slerp into the part that only depends on the two keys and the
+ * part that depends on t. prepareSlerpBatch normalizes b[i], flips it into
+ * the hemisphere of a[i] and stores cos(theta) - 1 of the pair.
+ * quatSlerpPreparedBatch then blends with no dot products or branches;
+ * a[i] must already be unit length.
+ */
+void prepareSlerpBatch(const glm::fquat* a, const glm::fquat* b,
+                       glm::fquat* b_aligned, float* cos_minus_one, size_t n);
+void quatSlerpPreparedBatch(const glm::fquat* a, const glm::fquat* b_aligned,
+                            const float* cos_minus_one, float t, glm::fquat* out, size_t n);
+
+/*
+ * out[i] = translate(trans[i]) * mat4_cast(rot[i]), i.e. a 3x4 affine
+ * matrix stored in a mat4 whose last row is (0, 0, 0, 1).
+ */
+void quatToAffineBatch(const glm::fquat* rot, const glm::vec3* trans, glm::mat4* out, size_t n);
+
+/*
+ * out[i] = a[i] * b[i], out may alias a or b.
+ */
+void mat4MultiplyBatch(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t n);
+
+/*
+ * Composes local transforms with their parent's world transform for the
+ * joints ids[0, n):
+ *      world_rot[i] = world_rot[parent[i]] * local_rot[i]
+ *      world_trans[i] = world_trans[parent[i]] + world_rot[parent[i]] * local_trans[i]
+ * None of the parents may be among ids, e.g. ids is one level of the
+ * skeleton.
+ */
+void composeAffineBatch(const int* ids, size_t n, const int* parent,
+                        const glm::fquat* local_rot, const glm::vec3* local_trans,
+                        glm::fquat* world_rot, glm::vec3* world_trans);
+
+#endif
@@ -1,5 +1,6 @@
 #include <GL/glew.h>
 #include "render_pass.h"
+#include "texture_registry.h"
 #include <iostream>
 #include <debuggl.h>
 #include <map>
@@ -192,10 +193,11 @@ void RenderPass::initMaterialUniform()
 }
 
 /*
- * Create textures to gltextures_
+ * Acquire textures to gltextures_
  * and assign material specified textures to matexids_
  * 
- * Different materials may share textures
+ * Different materials, and different passes, may share textures;
+ * TextureRegistry uploads each image once.
  */
 void RenderPass::createMaterialTexture()
 {
@@ -211,41 +213,14 @@ void RenderPass::createMaterialTexture()
 			matexids_.emplace_back(0);
 			continue;
 		}
-		// Do not create multiple texture for the same data.
+		// Acquire each texture once per pass.
 		auto iter = tex2id.find(ma.texture.get());
 		if (iter != tex2id.end()) {
 			matexids_.emplace_back(iter->second);
 			continue;
 		}
-
-		// Now create and upload texture data
-		int w = ma.texture->width;
-		int h = ma.texture->height;
-		// TODO: enable stride
-		// Translate RGB to RGBA for alignment
-		std::vector<unsigned int> dummy(w*h);
-		const unsigned char* bytes = ma.texture->bytes.data();
-		for (int row = 0; row < h; row++) {
-			for (int col = 0; col < w; col++) {
-				unsigned r = bytes[row*w*3 + col*3];
-				unsigned g = bytes[row*w*3 + col*3 + 1];
-				unsigned b = bytes[row*w*3 + col*3 + 1];
-				dummy[row*w+col] = r | (g << 8) | (b << 16) | (0xFF << 24);
-			}
-		}
-		GLuint tex = 0;
-		CHECK_GL_ERROR(glGenTextures(1, &tex));
-		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
-		CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8,
-					w,
-					h));
-		CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h,
-					GL_RGBA, GL_UNSIGNED_BYTE,
-					dummy.data()));
-		//CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
-		std::cerr << __func__ << " load data into texture " << tex <<
-			" dim: " << w << " x " << h << std::endl;
-		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+		unsigned tex = TextureRegistry::instance().acquireTexture(ma.texture);
+		gltextures_.emplace_back(tex);
 		matexids_.emplace_back(tex);
 		tex2id[ma.texture.get()] = tex;
 	}
@@ -253,12 +228,13 @@ void RenderPass::createMaterialTexture()
 	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_WRAP_S, GL_REPEAT));
 	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_WRAP_T, GL_REPEAT));
 	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
 }
 
 RenderPass::~RenderPass()
 {
-	// TODO: Free resources
+	for (auto tex : gltextures_)
+		TextureRegistry::instance().releaseTexture(tex);
 }
 
 void RenderPass::updateVBO(int position, const void* data, size_t size)
@@ -0,0 +1,287 @@
+#include "texture_mips.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+int blockSize(ImageEncoding encoding)
+{
+	return encoding == kImageBC1 ? 8 : 16;
+}
+
+/*
+ * Level of tightly packed RGBA pixels, w x h, into the next one.
+ */
+void downsample(const unsigned char* in, int w, int h, unsigned char* out)
+{
+	int nw = std::max(1, w / 2);
+	int nh = std::max(1, h / 2);
+	for (int y = 0; y < nh; y++) {
+		// A level one pixel wide or high averages two pixels, not four.
+		const unsigned char* row0 = in + size_t(4) * w * std::min(2 * y, h - 1);
+		const unsigned char* row1 = in + size_t(4) * w * std::min(2 * y + 1, h - 1);
+		unsigned char* dst = out + size_t(4) * nw * y;
+		int x = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+		// 8 pixels of both rows make 4 pixels. Components are widened to
+		// 16 bits, the rows summed, then the columns: pixels 0 and 2 of
+		// each register line up with pixels 1 and 3 after unpacking.
+		if (w >= 2) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i two = _mm_set1_epi16(2);
+			for (; x + 4 <= nw; x += 4) {
+				const __m128i* a = reinterpret_cast<const __m128i*>(row0 + 8 * x);
+				const __m128i* b = reinterpret_cast<const __m128i*>(row1 + 8 * x);
+				__m128i a0 = _mm_loadu_si128(a);
+				__m128i a1 = _mm_loadu_si128(a + 1);
+				__m128i b0 = _mm_loadu_si128(b);
+				__m128i b1 = _mm_loadu_si128(b + 1);
+				__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+				__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+				__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+				__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+				__m128i q0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+				__m128i q1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+				q0 = _mm_srli_epi16(_mm_add_epi16(q0, two), 2);
+				q1 = _mm_srli_epi16(_mm_add_epi16(q1, two), 2);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_packus_epi16(q0, q1));
+			}
+		}
+#endif
+		for (; x < nw; x++) {
+			int x0 = 4 * std::min(2 * x, w - 1);
+			int x1 = 4 * std::min(2 * x + 1, w - 1);
+			for (int c = 0; c < 4; c++)
+				dst[4 * x + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] +
+				                                  row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+		}
+	}
+}
+
+int to565(const int rgb[3])
+{
+	return ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+}
+
+void from565(int c, int rgb[3])
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+void put16(unsigned char* out, int v)
+{
+	out[0] = (unsigned char)(v & 0xFF);
+	out[1] = (unsigned char)(v >> 8);
+}
+
+/*
+ * The color half of a BC1 or BC3 block. The endpoints are the corners of
+ * the bounding box of the colors, inset by 1/16 of its size, along the
+ * diagonal that follows how red and blue vary with green. Every pixel
+ * then takes the nearest of the four colors between them.
+ */
+void encodeColors(const unsigned char px[16][4], unsigned char* out)
+{
+	int lo[3] = { 255, 255, 255 };
+	int hi[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			lo[c] = std::min(lo[c], int(px[i][c]));
+			hi[c] = std::max(hi[c], int(px[i][c]));
+		}
+	}
+	int center[3];
+	for (int c = 0; c < 3; c++)
+		center[c] = (lo[c] + hi[c]) / 2;
+	int covariance_rg = 0, covariance_bg = 0;
+	for (int i = 0; i < 16; i++) {
+		int g = px[i][1] - center[1];
+		covariance_rg += (px[i][0] - center[0]) * g;
+		covariance_bg += (px[i][2] - center[2]) * g;
+	}
+	if (covariance_rg < 0)
+		std::swap(lo[0], hi[0]);
+	if (covariance_bg < 0)
+		std::swap(lo[2], hi[2]);
+	for (int c = 0; c < 3; c++) {
+		int inset = (hi[c] - lo[c]) / 16;
+		hi[c] -= inset;
+		lo[c] += inset;
+	}
+
+	// The first color has to be the greater one, or BC1 would switch
+	// to three colors and transparent black.
+	int c0 = to565(hi), c1 = to565(lo);
+	if (c0 < c1)
+		std::swap(c0, c1);
+	put16(out, c0);
+	put16(out + 2, c1);
+	std::memset(out + 4, 0, 4);
+	if (c0 == c1)
+		return;
+	int palette[4][3];
+	from565(c0, palette[0]);
+	from565(c1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	unsigned indices = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_distance = INT_MAX;
+		for (int k = 0; k < 4; k++) {
+			int distance = 0;
+			for (int c = 0; c < 3; c++) {
+				int d = px[i][c] - palette[k][c];
+				distance += d * d;
+			}
+			if (distance < best_distance) {
+				best = k;
+				best_distance = distance;
+			}
+		}
+		indices |= unsigned(best) << (2 * i);
+	}
+	for (int b = 0; b < 4; b++)
+		out[4 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+/*
+ * The alpha half of a BC3 block: the extremes of alpha and six values
+ * between them, 3 bits per pixel.
+ */
+void encodeAlpha(const unsigned char px[16][4], unsigned char* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++) {
+		a0 = std::max(a0, int(px[i][3]));
+		a1 = std::min(a1, int(px[i][3]));
+	}
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	std::memset(out + 2, 0, 6);
+	if (a0 == a1)
+		return;
+	int palette[8] = { a0, a1 };
+	for (int k = 2; k < 8; k++)
+		palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+	unsigned long long indices = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_distance = INT_MAX;
+		for (int k = 0; k < 8; k++) {
+			int distance = std::abs(px[i][3] - palette[k]);
+			if (distance < best_distance) {
+				best = k;
+				best_distance = distance;
+			}
+		}
+		indices |= (unsigned long long)best << (3 * i);
+	}
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+}
+
+int numberOfMipLevels(int width, int height)
+{
+	int levels = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+int mipLevelWidth(const Image& image, int level)
+{
+	return std::max(1, image.width >> level);
+}
+
+int mipLevelHeight(const Image& image, int level)
+{
+	return std::max(1, image.height >> level);
+}
+
+size_t mipLevelSize(ImageEncoding encoding, int width, int height)
+{
+	if (encoding == kImagePixels)
+		return size_t(4) * width * height;
+	return size_t(blockSize(encoding)) * ((width + 3) / 4) * ((height + 3) / 4);
+}
+
+size_t mipChainSize(ImageEncoding encoding, int width, int height, int levels)
+{
+	size_t size = 0;
+	for (int l = 0; l < levels; l++)
+		size += mipLevelSize(encoding, std::max(1, width >> l), std::max(1, height >> l));
+	return size;
+}
+
+size_t mipLevelOffset(const Image& image, int level)
+{
+	return mipChainSize(image.encoding, image.width, image.height, level);
+}
+
+void buildMipChain(Image& image)
+{
+	if (image.encoding != kImagePixels || image.levels != 1 || image.width <= 0 || image.height <= 0)
+		return;
+	image.levels = numberOfMipLevels(image.width, image.height);
+	image.bytes.resize(mipChainSize(kImagePixels, image.width, image.height, image.levels));
+	for (int l = 1; l < image.levels; l++)
+		downsample(image.bytes.data() + mipLevelOffset(image, l - 1),
+		           mipLevelWidth(image, l - 1), mipLevelHeight(image, l - 1),
+		           image.bytes.data() + mipLevelOffset(image, l));
+}
+
+void compressImage(Image& image)
+{
+	if (image.encoding != kImagePixels || image.width <= 0 || image.height <= 0)
+		return;
+	// Averages of opaque pixels are opaque, so the first level decides.
+	ImageEncoding encoding = kImageBC1;
+	size_t npixels = size_t(image.width) * image.height;
+	for (size_t i = 0; i < npixels; i++) {
+		if (image.bytes[4 * i + 3] != 0xFF) {
+			encoding = kImageBC3;
+			break;
+		}
+	}
+	int block_size = blockSize(encoding);
+	std::vector<unsigned char> blocks(mipChainSize(encoding, image.width, image.height, image.levels));
+	unsigned char* out = blocks.data();
+	for (int l = 0; l < image.levels; l++) {
+		const unsigned char* in = image.bytes.data() + mipLevelOffset(image, l);
+		int w = mipLevelWidth(image, l);
+		int h = mipLevelHeight(image, l);
+		// Blocks past the edge of a level repeat its last row and column.
+		for (int by = 0; by < h; by += 4) {
+			for (int bx = 0; bx < w; bx += 4) {
+				unsigned char px[16][4];
+				for (int i = 0; i < 16; i++) {
+					int x = std::min(bx + i % 4, w - 1);
+					int y = std::min(by + i / 4, h - 1);
+					std::memcpy(px[i], in + 4 * (size_t(w) * y + x), 4);
+				}
+				if (encoding == kImageBC3) {
+					encodeAlpha(px, out);
+					encodeColors(px, out + 8);
+				} else {
+					encodeColors(px, out);
+				}
+				out += block_size;
+			}
+		}
+	}
+	image.bytes.swap(blocks);
+	image.encoding = encoding;
+	image.stride = block_size * ((image.width + 3) / 4);
+}
@@ -0,0 +1,40 @@
+#ifndef TEXTURE_MIPS_H
+#define TEXTURE_MIPS_H
+
+#include <cstddef>
+#include <image.h> // header from utgraphicsutil
+
+/*
+ * Mip chains and block compression of textures, done once when a texture
+ * is imported so that uploading it is a copy.
+ *
+ * Level l of a width x height image is max(1, width >> l) by
+ * max(1, height >> l), as GL sizes them; a full chain goes down to 1 x 1.
+ */
+int numberOfMipLevels(int width, int height);
+int mipLevelWidth(const Image& image, int level);
+int mipLevelHeight(const Image& image, int level);
+
+/*
+ * Bytes of a level, and of the first levels of an image; the levels
+ * follow each other in Image::bytes without padding.
+ */
+size_t mipLevelSize(ImageEncoding encoding, int width, int height);
+size_t mipChainSize(ImageEncoding encoding, int width, int height, int levels);
+size_t mipLevelOffset(const Image& image, int level);
+
+/*
+ * Appends the full mip chain to a single level of tightly packed RGBA
+ * pixels. Every level averages 2 x 2 pixels of the one before; an odd
+ * last row or column is dropped, as GL rounds sizes down.
+ */
+void buildMipChain(Image& image);
+
+/*
+ * Replaces the RGBA levels of an image by BC1 blocks, or by BC3 blocks if
+ * any pixel is not opaque. BC1 takes an eighth of the memory, BC3 a
+ * quarter.
+ */
+void compressImage(Image& image);
+
+#endif
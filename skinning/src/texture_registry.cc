@@ -0,0 +1,135 @@
+#include <GL/glew.h>
+#include "texture_registry.h"
+#include "mapped_file.h"
+#include "texture_mips.h"
+#include <bitmap.h>
+#include <debuggl.h>
+#include <iostream>
+
+TextureRegistry& TextureRegistry::instance()
+{
+	// Never destroyed: at exit the GL context is already gone.
+	static TextureRegistry* registry = new TextureRegistry;
+	return *registry;
+}
+
+std::shared_ptr<Image> TextureRegistry::load(const std::string& fn)
+{
+	MappedFile file;
+	if (!file.open(fn)) {
+		std::cerr << "Cannot open texture " << fn << std::endl;
+		return nullptr;
+	}
+	uint64_t hash = hashBytes(file.data(), file.size());
+	auto image = find(hash, file.size());
+	if (image)
+		return image;
+	// Decoded outside the lock; if another thread decoded the same
+	// contents meanwhile, share keeps the first image.
+	image = std::make_shared<Image>();
+	if (!decodeBMP(reinterpret_cast<const unsigned char*>(file.data()), file.size(), *image)) {
+		std::cerr << "Cannot decode texture " << fn << std::endl;
+		return nullptr;
+	}
+	buildMipChain(*image);
+	if (compression_)
+		compressImage(*image);
+	return share(hash, file.size(), image);
+}
+
+std::shared_ptr<Image> TextureRegistry::find(uint64_t hash, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto iter = images_.find(std::make_pair(hash, size));
+	return iter == images_.end() ? nullptr : iter->second.lock();
+}
+
+std::shared_ptr<Image> TextureRegistry::share(uint64_t hash, uint64_t size, const std::shared_ptr<Image>& image)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::weak_ptr<Image>& entry = images_[std::make_pair(hash, size)];
+	auto registered = entry.lock();
+	if (registered)
+		return registered;
+	entry = image;
+	// Entries of images that died are dropped once they outnumber the
+	// live ones, so the map does not grow with every model loaded.
+	if (images_.size() > 16) {
+		size_t live = 0;
+		for (const auto& kv : images_)
+			live += !kv.second.expired();
+		if (live * 2 < images_.size()) {
+			for (auto iter = images_.begin(); iter != images_.end();) {
+				if (iter->second.expired())
+					iter = images_.erase(iter);
+				else
+					++iter;
+			}
+		}
+	}
+	return image;
+}
+
+size_t TextureRegistry::numberOfImages()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t live = 0;
+	for (const auto& kv : images_)
+		live += !kv.second.expired();
+	return live;
+}
+
+unsigned TextureRegistry::acquireTexture(const std::shared_ptr<Image>& image)
+{
+	Texture& texture = textures_[image.get()];
+	if (texture.references++ > 0)
+		return texture.id;
+	texture.image = image;
+	int w = image->width;
+	int h = image->height;
+	GLuint tex = 0;
+	CHECK_GL_ERROR(glGenTextures(1, &tex));
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
+	GLenum format = GL_RGBA8;
+	if (image->encoding == kImageBC1)
+		format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	else if (image->encoding == kImageBC3)
+		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, image->levels, format, w, h));
+	// Levels are tightly packed RGBA, as decodeBMP writes them, or
+	// blocks; either way they are passed on as they are.
+	for (int l = 0; l < image->levels; l++) {
+		const unsigned char* level = image->bytes.data() + mipLevelOffset(*image, l);
+		int lw = mipLevelWidth(*image, l);
+		int lh = mipLevelHeight(*image, l);
+		if (image->encoding == kImagePixels) {
+			CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, lw, lh,
+			                               GL_RGBA, GL_UNSIGNED_BYTE, level));
+		} else {
+			GLsizei size = GLsizei(mipLevelSize(image->encoding, lw, lh));
+			CHECK_GL_ERROR(glCompressedTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, lw, lh,
+			                                         format, size, level));
+		}
+	}
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+	std::cerr << __func__ << " load data into texture " << tex <<
+		" dim: " << w << " x " << h << " levels: " << image->levels <<
+		" bytes: " << image->bytes.size() << std::endl;
+	texture.id = tex;
+	texture_images_[tex] = image.get();
+	return tex;
+}
+
+void TextureRegistry::releaseTexture(unsigned id)
+{
+	auto iter = texture_images_.find(id);
+	if (iter == texture_images_.end())
+		return;
+	auto texture = textures_.find(iter->second);
+	if (--texture->second.references > 0)
+		return;
+	GLuint tex = id;
+	CHECK_GL_ERROR(glDeleteTextures(1, &tex));
+	textures_.erase(texture);
+	texture_images_.erase(iter);
+}
@@ -0,0 +1,81 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <image.h> // header from utgraphicsutil
+
+/*
+ * Textures shared by every model of the process, keyed by a hash and the
+ * size of the texture file, so a texture used by several models, or under several
+ * names, is decoded once and uploaded once. Images are loaded with their
+ * mip chain, and block compressed if compression is on.
+ *
+ * Decoded images are held weakly: an image stays registered as long as
+ * some Material holds it. GL textures are counted by the render passes
+ * that acquired them and deleted with the last release.
+ */
+class TextureRegistry {
+public:
+	static TextureRegistry& instance();
+
+	/*
+	 * The decoded image of a texture file, null if it cannot be read or
+	 * decoded. Safe to call from several threads.
+	 */
+	std::shared_ptr<Image> load(const std::string& fn);
+
+	/*
+	 * Whether images loaded from now on are BC1/BC3 compressed, which
+	 * takes EXT_texture_compression_s3tc to upload. Off until set; set
+	 * it before loading models.
+	 */
+	void setCompression(bool compress) { compression_ = compress; }
+	bool compression() const { return compression_; }
+
+	/*
+	 * For images decoded elsewhere, e.g. read back from a model cache.
+	 * find returns the live image of a file of size bytes hashing to
+	 * hash, if any; share registers image under the two unless another
+	 * one was first, and returns the registered one. The hash is not
+	 * cryptographic, the size keeps a collision between files that
+	 * differ in length from swapping their textures. Both are safe to
+	 * call from several threads.
+	 */
+	std::shared_ptr<Image> find(uint64_t hash, uint64_t size);
+	std::shared_ptr<Image> share(uint64_t hash, uint64_t size, const std::shared_ptr<Image>& image);
+
+	/*
+	 * The GL texture of an image, uploaded the first time it is
+	 * acquired. Every acquire has to be matched by a release. GL thread
+	 * only.
+	 */
+	unsigned acquireTexture(const std::shared_ptr<Image>& image);
+	void releaseTexture(unsigned texture);
+
+	size_t numberOfImages();  // Live ones
+	size_t numberOfTextures() const { return textures_.size(); }
+
+private:
+	TextureRegistry() = default;
+	TextureRegistry(const TextureRegistry&) = delete;
+	TextureRegistry& operator=(const TextureRegistry&) = delete;
+
+	bool compression_ = false;
+	std::mutex mutex_;
+	std::map<std::pair<uint64_t, uint64_t>, std::weak_ptr<Image>> images_; // (hash, size) -> image
+
+	struct Texture {
+		std::shared_ptr<Image> image; // Keeps the key from being reused
+		unsigned id = 0;
+		int references = 0;
+	};
+	std::map<const Image*, Texture> textures_;
+	std::map<unsigned, const Image*> texture_images_;
+};
+
+#endif
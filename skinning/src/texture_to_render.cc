@@ -9,7 +9,7 @@ TextureToRender::TextureToRender()
 
 TextureToRender::~TextureToRender()
 {
-	if (fb_ < 0)
+	if (fb_ == (unsigned int)-1)
 		return ;
 	unbind();
 	glDeleteFramebuffers(1, &fb_);
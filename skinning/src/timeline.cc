@@ -0,0 +1,268 @@
+#include "timeline.h"
+#include "pose_kernels.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <iterator>
+
+int locateSegment(const float* time, int count, float t, float* percent, int& cursor)
+{
+	int last = count - 1;
+	int k = std::min(std::max(cursor, 0), last - 1);
+	if (t < time[k] || t >= time[k + 1]) {
+		if (k + 2 <= last && t >= time[k + 1] && t < time[k + 2]) {
+			k++;
+		} else {
+			k = int(std::upper_bound(time, time + count, t) - time) - 1;
+			k = std::min(std::max(k, 0), last - 1);
+		}
+	}
+	cursor = k;
+	*percent = (t - time[k]) / (time[k + 1] - time[k]);
+	return k;
+}
+
+uint64_t TimelineKeys::hash() const
+{
+	uint64_t parts[4] = {
+		uint64_t(njoints),
+		hashBytes(reinterpret_cast<const char*>(rel_rot.data()), rel_rot.size() * sizeof(glm::fquat)),
+		hashBytes(reinterpret_cast<const char*>(root_trans.data()), root_trans.size() * sizeof(glm::vec3)),
+		hashBytes(reinterpret_cast<const char*>(times.data()), times.size() * sizeof(float))
+	};
+	return hashBytes(reinterpret_cast<const char*>(parts), sizeof(parts));
+}
+
+void Timeline::reset(int njoints)
+{
+	clear();
+	edit().njoints = njoints;
+}
+
+void Timeline::clear()
+{
+	if (keys_.use_count() > 1) {
+		int njoints = keys_->njoints;
+		keys_ = std::make_shared<TimelineKeys>();
+		keys_->njoints = njoints;
+	}
+	keys_->rel_rot.clear();
+	keys_->root_trans.clear();
+	keys_->times.clear();
+	handles_.clear();
+	previews_.clear();
+	// Every slot is released, so the dropped handles name no keyframe
+	// anymore and differ from the ones made from now on.
+	free_slots_.clear();
+	for (int slot = int(index_of_.size()) - 1; slot >= 0; slot--) {
+		if (index_of_[slot] >= 0)
+			generation_[slot] = (generation_[slot] + 1) & kGenerationMask;
+		index_of_[slot] = -1;
+		free_slots_.push_back(slot);
+	}
+	invalidate(0);
+}
+
+Timeline::Handle Timeline::append(const glm::fquat* rel_rot, const glm::vec3& root_trans)
+{
+	return append(rel_rot, root_trans, empty() ? 0.0f : endTime() + 1.0f);
+}
+
+Timeline::Handle Timeline::append(const glm::fquat* rel_rot, const glm::vec3& root_trans, float time)
+{
+	insert(size(), 1, rel_rot, &root_trans, &time);
+	return handles_.back();
+}
+
+void Timeline::insert(int index, int count, const glm::fquat* rel_rot, const glm::vec3* root_trans, const float* time)
+{
+	if (count <= 0)
+		return;
+	TimelineKeys& keys = edit();
+	size_t offset = size_t(index) * keys.njoints;
+	keys.rel_rot.insert(keys.rel_rot.begin() + offset, rel_rot, rel_rot + size_t(count) * keys.njoints);
+	quatNormalizeBatch(keys.rel_rot.data() + offset, size_t(count) * keys.njoints);
+	keys.root_trans.insert(keys.root_trans.begin() + index, root_trans, root_trans + count);
+	keys.times.insert(keys.times.begin() + index, time, time + count);
+
+	std::vector<Handle> added(count);
+	for (int i = 0; i < count; i++)
+		added[i] = allocateHandle();
+	handles_.insert(handles_.begin() + index, added.begin(), added.end());
+
+	std::vector<std::unique_ptr<TextureToRender>> textures(count);
+	previews_.insert(previews_.begin() + index,
+	                 std::make_move_iterator(textures.begin()),
+	                 std::make_move_iterator(textures.end()));
+	renumber(index);
+	invalidate(index);
+}
+
+void Timeline::erase(int index, int count)
+{
+	if (count <= 0)
+		return;
+	for (int i = index; i < index + count; i++)
+		releaseHandle(handles_[i]);
+	TimelineKeys& keys = edit();
+	size_t offset = size_t(index) * keys.njoints;
+	keys.rel_rot.erase(keys.rel_rot.begin() + offset, keys.rel_rot.begin() + offset + size_t(count) * keys.njoints);
+	keys.root_trans.erase(keys.root_trans.begin() + index, keys.root_trans.begin() + index + count);
+	keys.times.erase(keys.times.begin() + index, keys.times.begin() + index + count);
+	handles_.erase(handles_.begin() + index, handles_.begin() + index + count);
+	previews_.erase(previews_.begin() + index, previews_.begin() + index + count);
+	renumber(index);
+	invalidate(index);
+}
+
+void Timeline::retain(const std::vector<char>& keep)
+{
+	int first = 0;
+	while (first < size() && keep[first])
+		first++;
+	int kept = first;
+	TimelineKeys& keys = edit();
+	for (int i = first; i < size(); i++) {
+		if (!keep[i]) {
+			releaseHandle(handles_[i]);
+			continue;
+		}
+		std::copy(relRot(i), relRot(i) + keys.njoints, keys.rel_rot.begin() + size_t(kept) * keys.njoints);
+		keys.root_trans[kept] = keys.root_trans[i];
+		keys.times[kept] = keys.times[i];
+		handles_[kept] = handles_[i];
+		previews_[kept] = std::move(previews_[i]);
+		kept++;
+	}
+	keys.rel_rot.resize(size_t(kept) * keys.njoints);
+	keys.root_trans.resize(kept);
+	keys.times.resize(kept);
+	handles_.resize(kept);
+	previews_.resize(kept);
+	renumber(first);
+	invalidate(first);
+}
+
+void Timeline::set(int index, const glm::fquat* rel_rot, const glm::vec3& root_trans)
+{
+	TimelineKeys& keys = edit();
+	glm::fquat* dst = keys.rel_rot.data() + size_t(index) * keys.njoints;
+	std::copy(rel_rot, rel_rot + keys.njoints, dst);
+	quatNormalizeBatch(dst, keys.njoints);
+	keys.root_trans[index] = root_trans;
+	invalidate(index);
+}
+
+void Timeline::shiftTimes(int begin, float delta)
+{
+	TimelineKeys& keys = edit();
+	for (int i = begin; i < size(); i++)
+		keys.times[i] += delta;
+	revision_++;
+}
+
+void Timeline::interpolate(int segment, float percent, glm::fquat* rel_rot, glm::vec3* root_trans) const
+{
+	prepare();
+	int njoints = getNumberOfJoints();
+	size_t offset = size_t(segment) * njoints;
+	quatSlerpPreparedBatch(relRot(segment), aligned_end_.data() + offset,
+	                       cos_minus_one_.data() + offset, percent, rel_rot, njoints);
+	*root_trans = glm::mix(rootTrans(segment), rootTrans(segment + 1), percent);
+}
+
+int Timeline::locate(float t, float* percent) const
+{
+	return locate(t, percent, cursor_);
+}
+
+int Timeline::locate(float t, float* percent, int& cursor) const
+{
+	return locateSegment(keys_->times.data(), size(), t, percent, cursor);
+}
+
+int Timeline::indexOf(Handle handle) const
+{
+	if (handle < 0)
+		return -1;
+	int slot = int(handle & kSlotMask);
+	if (slot >= int(index_of_.size()) || generation_[slot] != uint32_t(handle >> kSlotBits))
+		return -1;
+	return index_of_[slot];
+}
+
+Timeline::Handle Timeline::allocateHandle()
+{
+	int slot;
+	if (!free_slots_.empty()) {
+		slot = free_slots_.back();
+		free_slots_.pop_back();
+	} else {
+		slot = int(index_of_.size());
+		index_of_.push_back(-1);
+		generation_.push_back(0);
+	}
+	return Handle(slot) | Handle(generation_[slot]) << kSlotBits;
+}
+
+void Timeline::releaseHandle(Handle handle)
+{
+	int slot = int(handle & kSlotMask);
+	index_of_[slot] = -1;
+	generation_[slot] = (generation_[slot] + 1) & kGenerationMask;
+	free_slots_.push_back(slot);
+}
+
+TextureToRender* Timeline::preview(int index)
+{
+	if (!previews_[index])
+		previews_[index].reset(new TextureToRender());
+	return previews_[index].get();
+}
+
+void Timeline::releasePreview(int index)
+{
+	previews_[index].reset();
+}
+
+TextureToRender* Timeline::findPreview(Handle handle)
+{
+	int index = indexOf(handle);
+	return index == -1 ? nullptr : previews_[index].get();
+}
+
+TimelineKeys& Timeline::edit()
+{
+	if (keys_.use_count() > 1)
+		keys_ = std::make_shared<TimelineKeys>(*keys_);
+	return *keys_;
+}
+
+void Timeline::renumber(int begin)
+{
+	for (int i = begin; i < size(); i++)
+		index_of_[handles_[i] & kSlotMask] = i;
+}
+
+void Timeline::invalidate(int index)
+{
+	// Segments index - 1 and index touch the keyframe, later ones moved.
+	prepared_ = std::min(prepared_, std::max(index - 1, 0));
+	revision_++;
+}
+
+void Timeline::prepare() const
+{
+	int nsegments = std::max(size() - 1, 0);
+	if (prepared_ >= nsegments)
+		return;
+	int njoints = getNumberOfJoints();
+	aligned_end_.resize(size_t(nsegments) * njoints);
+	cos_minus_one_.resize(size_t(nsegments) * njoints);
+	for (int k = prepared_; k < nsegments; k++) {
+		size_t offset = size_t(k) * njoints;
+		prepareSlerpBatch(relRot(k), relRot(k + 1),
+		                  aligned_end_.data() + offset,
+		                  cos_minus_one_.data() + offset, njoints);
+	}
+	prepared_ = nsegments;
+}
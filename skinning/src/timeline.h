@@ -0,0 +1,176 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "texture_to_render.h"
+
+/*
+ * The keyframe data of a Timeline: per keyframe, njoints rotations, the
+ * root translation and the time. Shared between a timeline and its
+ * snapshots and never changed while shared.
+ */
+struct TimelineKeys {
+	int njoints = 0;
+	std::vector<glm::fquat> rel_rot;
+	std::vector<glm::vec3> root_trans;
+	std::vector<float> times;
+
+	int size() const { return int(times.size()); }
+	int getNumberOfJoints() const { return njoints; }
+	float time(int index) const { return times[index]; }
+	const glm::fquat* relRot(int index) const { return rel_rot.data() + size_t(index) * njoints; }
+	const glm::vec3& rootTrans(int index) const { return root_trans[index]; }
+
+	/*
+	 * Hash of the contents, stored with the clips made from the keys so
+	 * that a clip is only used with the keys it was made from.
+	 */
+	uint64_t hash() const;
+};
+
+/*
+ * Keyframes of one animation.
+ *
+ * A keyframe only stores what the animator can change: the local rotation
+ * of every joint and the root translation. U is the same for every
+ * keyframe, and T and D follow from the rotations through forward
+ * kinematics once the keyframe is applied to the skeleton.
+ *
+ * All rotations live in one arena, keyframe k owns
+ * keys().rel_rot[k * njoints, (k + 1) * njoints). Inserting or erasing keyframes
+ * shifts the arena, so indices change; handles do not. A handle names one
+ * keyframe until it is erased. Its slot is then reused with a new
+ * generation, so the old handle keeps naming no keyframe, and clear()
+ * drops all slots.
+ *
+ * Every keyframe has a timestamp in seconds, and timestamps never
+ * decrease with the index. Segment k runs from keyframe k to k + 1.
+ *
+ * Playback blends within a segment, and everything that only depends on
+ * the two keys of a segment is computed once and cached. Segments before
+ * the first edited keyframe stay valid, so appending keys or editing the
+ * last one only prepares the new segments.
+ *
+ * The arena is copy on write. snapshot() is a reference to the current
+ * keys that later edits leave alone, so a save can read it on another
+ * thread; the first edit after a snapshot copies the keys once.
+ *
+ * Preview textures are kept beside the arena, one per keyframe, and move
+ * with their keyframe. They are only allocated once asked for, so loading
+ * a long timeline does not allocate per keyframe.
+ */
+class Timeline {
+public:
+	typedef int64_t Handle;
+
+	void reset(int njoints); // Drop all keyframes and change the joint count
+	void clear();
+
+	int size() const { return int(handles_.size()); }
+	bool empty() const { return handles_.empty(); }
+	int getNumberOfJoints() const { return keys_->njoints; }
+
+	/*
+	 * rel_rot points to getNumberOfJoints() rotations per keyframe.
+	 * Without a time, append places the keyframe one second after the
+	 * last one. insert expects times that keep the timeline sorted.
+	 */
+	Handle append(const glm::fquat* rel_rot, const glm::vec3& root_trans);
+	Handle append(const glm::fquat* rel_rot, const glm::vec3& root_trans, float time);
+	void insert(int index, int count, const glm::fquat* rel_rot, const glm::vec3* root_trans, const float* time);
+	void erase(int index, int count = 1);
+	void retain(const std::vector<char>& keep); // Erase every keyframe i with !keep[i] in one pass
+
+	float time(int index) const { return keys_->times[index]; }
+	float duration(int segment) const { return time(segment + 1) - time(segment); }
+	float endTime() const { return empty() ? 0.0f : keys_->times.back(); }
+	void shiftTimes(int begin, float delta); // Move keyframes [begin, size()) by delta seconds
+
+	/*
+	 * Finds the segment that contains t, i.e. time(k) <= t < time(k + 1),
+	 * and how far into it t is, in [0, 1). Needs at least two keyframes
+	 * and time(0) <= t < endTime().
+	 *
+	 * The last segment found is remembered, so playing forward usually
+	 * costs one or two comparisons. Other jumps fall back to a binary
+	 * search.
+	 */
+	int locate(float t, float* percent) const;
+	int locate(float t, float* percent, int& cursor) const; // For callers on other threads
+
+	/*
+	 * Changes whenever keyframes or their times change, so derived data
+	 * such as a baked clip can tell whether it is still current.
+	 */
+	unsigned revision() const { return revision_; }
+
+	/*
+	 * Pose at percent of the way through a segment, as returned by locate.
+	 */
+	void interpolate(int segment, float percent, glm::fquat* rel_rot, glm::vec3* root_trans) const;
+	void prepare() const; // Done by interpolate, call first when interpolating from several threads
+
+	void set(int index, const glm::fquat* rel_rot, const glm::vec3& root_trans);
+	const glm::fquat* relRot(int index) const { return keys_->relRot(index); }
+	const glm::vec3& rootTrans(int index) const { return keys_->rootTrans(index); }
+
+	const TimelineKeys& keys() const { return *keys_; }
+	std::shared_ptr<const TimelineKeys> snapshot() const { return keys_; }
+
+	Handle handle(int index) const { return handles_[index]; }
+	int indexOf(Handle handle) const; // -1 once the keyframe is erased
+
+	/*
+	 * Previews are only made for keyframes in view, a long motion would
+	 * otherwise hold a framebuffer per keyframe.
+	 */
+	TextureToRender* preview(int index); // Created on first use
+	bool hasPreview(int index) const { return previews_[index] != nullptr; }
+	void releasePreview(int index);
+	TextureToRender* findPreview(Handle handle); // nullptr if erased or not made yet
+
+private:
+	std::shared_ptr<TimelineKeys> keys_ = std::make_shared<TimelineKeys>();
+	/*
+	 * A handle is a slot in index_of_ and the generation of that slot
+	 * when the handle was made, above kSlotBits. A slot's generation goes
+	 * up whenever its keyframe goes away, clear() included, so it only
+	 * repeats after 2^31 keyframes have used the slot.
+	 */
+	static const int kSlotBits = 32;
+	static const int64_t kSlotMask = (int64_t(1) << kSlotBits) - 1;
+	static const uint32_t kGenerationMask = 0x7FFFFFFF; // Keeps handles positive
+	std::vector<Handle> handles_;      // index -> handle
+	std::vector<int> index_of_;        // slot -> index, -1 if free
+	std::vector<uint32_t> generation_; // slot -> generation of its handle
+	std::vector<int> free_slots_;
+	std::vector<std::unique_ptr<TextureToRender>> previews_;
+	mutable int cursor_ = 0;
+
+	/*
+	 * Per segment and joint: the end key flipped into the start key's
+	 * hemisphere, and cos(theta) - 1 between them. Segments
+	 * [0, prepared_) are current.
+	 */
+	mutable std::vector<glm::fquat> aligned_end_;
+	mutable std::vector<float> cos_minus_one_;
+	mutable int prepared_ = 0;
+	unsigned revision_ = 0;
+
+	TimelineKeys& edit(); // keys_, copied first if a snapshot shares them
+	Handle allocateHandle();
+	void releaseHandle(Handle handle);
+	void renumber(int begin);
+	void invalidate(int index); // keyframe index changed
+};
+
+/*
+ * Timeline::locate over any sorted time array with count >= 2 entries.
+ */
+int locateSegment(const float* time, int count, float t, float* percent, int& cursor);
+
+#endif
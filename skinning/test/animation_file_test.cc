@@ -0,0 +1,154 @@
+/*
+ * Saves an animation of a small hand-built skeleton in every format and
+ * loads it back. Journals, .bake and .vmc files are matched to the keys
+ * they were made from by TimelineKeys::hash(), so loading has to give back
+ * the saved keys bit for bit. Exits with 1 if any check fails.
+ */
+#include "bone_geometry.h"
+#include "animation_saver.h"
+#include <cstdio>
+#include <random>
+#include <string>
+
+namespace {
+	const int kJoints = 20;
+	const int kKeys = 40;
+
+	std::mt19937 rng(7);
+	int failures = 0;
+
+	float uniform(float lo, float hi)
+	{
+		return std::uniform_real_distribution<float>(lo, hi)(rng);
+	}
+
+	void check(bool ok, const std::string& fn, const char* what)
+	{
+		if (ok)
+			return;
+		failures++;
+		std::printf("%s: %s\n", fn.c_str(), what);
+	}
+
+	/*
+	 * A chain of joints, so FK and baking have something to do.
+	 */
+	void buildSkeleton(Mesh& mesh)
+	{
+		for (int i = 0; i < kJoints; i++)
+			mesh.skeleton.addJoint(glm::vec3(0.1f * i, 1.0f + i, 0.0f), i - 1);
+		mesh.skeleton.buildTopology();
+		mesh.timeline.reset(kJoints);
+	}
+
+	void setRandomPose(Mesh& mesh)
+	{
+		for (auto& q : mesh.skeleton.local_rot)
+			q = glm::normalize(glm::fquat(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)));
+		mesh.skeleton.root_trans = glm::vec3(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+		mesh.skeleton.forwardKinematics();
+	}
+
+	void removeFiles(const std::string& fn)
+	{
+		for (const char* suffix : { "", ".journal", ".bake", ".vmc" })
+			std::remove((fn + suffix).c_str());
+	}
+
+	void testRoundTrip(const std::string& fn)
+	{
+		removeFiles(fn);
+		uint64_t saved_hash;
+		{
+			Mesh mesh;
+			buildSkeleton(mesh);
+			for (int i = 0; i < kKeys; i++) {
+				setRandomPose(mesh);
+				mesh.addKeyframe();
+			}
+			mesh.saveAnimationTo(fn);
+			saved_hash = mesh.timeline.keys().hash();
+		}
+		Mesh mesh;
+		buildSkeleton(mesh);
+		mesh.loadAnimationFrom(fn);
+		check(mesh.timeline.size() == kKeys, fn, "wrong number of keyframes");
+		check(mesh.timeline.keys().hash() == saved_hash, fn, "keys differ after loading");
+		removeFiles(fn);
+	}
+
+	/*
+	 * A bake and a compressed clip saved with the animation are used
+	 * after loading it, as they were made from the same keys.
+	 */
+	void testSideFiles(const std::string& fn)
+	{
+		removeFiles(fn);
+		{
+			Mesh mesh;
+			buildSkeleton(mesh);
+			for (int i = 0; i < kKeys; i++) {
+				setRandomPose(mesh);
+				mesh.addKeyframe();
+			}
+			mesh.bake(30.0f);
+			mesh.compressAnimation();
+			mesh.saveAnimationTo(fn);
+		}
+		Mesh mesh;
+		buildSkeleton(mesh);
+		mesh.loadAnimationFrom(fn);
+		check(mesh.isBakeCurrent(), fn, ".bake was not used");
+		check(mesh.isCompressedCurrent(), fn, ".vmc was not used");
+		removeFiles(fn);
+	}
+
+	/*
+	 * Dies after the compacted file is in place but before the journal is
+	 * reset: the edits made after the snapshot have to come back.
+	 */
+	void testCompactionCrash(const std::string& fn)
+	{
+		removeFiles(fn);
+		uint64_t edited_hash;
+		{
+			Mesh mesh;
+			buildSkeleton(mesh);
+			for (int i = 0; i < kKeys / 2; i++) {
+				setRandomPose(mesh);
+				mesh.addKeyframe();
+			}
+			mesh.saveAnimationTo(fn);
+			mesh.journal.beginCompaction(mesh.timeline);
+			AnimationSnapshot snapshot = mesh.snapshotAnimation();
+			for (int i = kKeys / 2; i < kKeys; i++) {
+				setRandomPose(mesh);
+				mesh.addKeyframe();
+			}
+			mesh.journal.flush();
+			writeAnimationSnapshot(snapshot, fn);
+			edited_hash = mesh.timeline.keys().hash();
+			mesh.journal.detach();
+		}
+		Mesh mesh;
+		buildSkeleton(mesh);
+		mesh.loadAnimationFrom(fn);
+		check(mesh.timeline.keys().hash() == edited_hash, fn, "edits made during compaction are lost");
+		removeFiles(fn);
+	}
+}
+
+int main()
+{
+	for (const char* fn : { "animation_file_test.json", "animation_file_test.vma" }) {
+		testRoundTrip(fn);
+		testSideFiles(fn);
+		testCompactionCrash(fn);
+	}
+	if (failures) {
+		std::printf("%d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("Animations load as saved\n");
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Times decodeBMP against the decoding it replaced, which swapped BGR to
+ * RGB in place, one pixel at a time, keeping the row padding, and then
+ * copied the rows out again with an alpha byte added. Both decode the
+ * same files from memory, so file reads do not count; the results are
+ * compared byte for byte. Exits with 1 if a file fails to decode or the
+ * two disagree.
+ *
+ *      bmp_decode_bench file.bmp...
+ *
+ * The bench_bmp_decode target runs it over the textures in assets/pmd.
+ */
+#include "bitmap.h"
+#include "image.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+	const int kRounds = 50;
+
+	/*
+	 * The decoding before decodeBMP, less its file reads. Its swap loop
+	 * skipped the row padding of the input but not of the output, which
+	 * garbled bitmaps whose rows are padded; here it skips both, so the
+	 * results can be compared.
+	 */
+	bool decodeOld(const std::vector<unsigned char>& file, Image& image)
+	{
+		if (file.size() < 54 || file[0] != 'B' || file[1] != 'M')
+			return false;
+		BMP_DWORD pos;
+		BMP_BITMAPINFOHEADER bmih;
+		std::memcpy(&pos, &file[10], 4);
+		std::memcpy(&bmih, &file[14], sizeof(bmih));
+		if (bmih.biBitCount != 24)
+			return false;
+		int width = image.width = bmih.biWidth;
+		int height = image.height = bmih.biHeight;
+		int padWidth = width * 3;
+		int pad = 0;
+		if (padWidth % 4 != 0) {
+			pad = 4 - (padWidth % 4);
+			padWidth += pad;
+		}
+		size_t bytes = size_t(height) * padWidth;
+		if (file.size() < pos + bytes)
+			return false;
+		image.stride = padWidth;
+		image.bytes.assign(file.begin() + pos, file.begin() + pos + bytes);
+
+		unsigned char* in = image.bytes.data();
+		unsigned char* out = image.bytes.data();
+		for (int j = 0; j < height; ++j) {
+			for (int i = 0; i < width; ++i) {
+				out[1] = in[1];
+				unsigned char temp = in[2];
+				out[2] = in[0];
+				out[0] = temp;
+				in += 3;
+				out += 3;
+			}
+			in += pad;
+			out += pad;
+		}
+
+		std::vector<unsigned char> rgba(size_t(width) * height * 4);
+		for (int row = 0; row < height; row++) {
+			const unsigned char* rgb = image.bytes.data() + size_t(row) * image.stride;
+			unsigned char* dst = rgba.data() + size_t(row) * width * 4;
+			for (int col = 0; col < width; col++) {
+				dst[0] = rgb[0];
+				dst[1] = rgb[1];
+				dst[2] = rgb[2];
+				dst[3] = 0xFF;
+				rgb += 3;
+				dst += 4;
+			}
+		}
+		image.bytes.swap(rgba);
+		image.stride = width * 4;
+		return true;
+	}
+
+	template<typename Decode>
+	double secondsPerRound(const std::vector<std::vector<unsigned char>>& files, Decode decode)
+	{
+		Image image;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < kRounds; r++) {
+			for (const auto& file : files)
+				decode(file, image);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / kRounds;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::vector<unsigned char>> files;
+	double npixels = 0.0;
+	for (int i = 1; i < argc; i++) {
+		std::ifstream in(argv[i], std::ios::binary);
+		std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		Image old_image, new_image;
+		if (!decodeOld(file, old_image) || !decodeBMP(file.data(), file.size(), new_image)) {
+			std::printf("%s: cannot decode\n", argv[i]);
+			return 1;
+		}
+		if (old_image.bytes != new_image.bytes || old_image.stride != new_image.stride) {
+			std::printf("%s: decodeBMP disagrees with the old decoding\n", argv[i]);
+			return 1;
+		}
+		npixels += double(new_image.width) * new_image.height;
+		files.push_back(std::move(file));
+	}
+	if (files.empty()) {
+		std::printf("Usage: %s file.bmp...\n", argv[0]);
+		return 1;
+	}
+
+	double old_seconds = secondsPerRound(files, decodeOld);
+	double new_seconds = secondsPerRound(files, [](const std::vector<unsigned char>& file, Image& image) {
+		return decodeBMP(file.data(), file.size(), image);
+	});
+	std::printf("%zu files, %.0f pixels\n", files.size(), npixels);
+	std::printf("old decoding: %8.3f ms, %.2f ns/pixel\n", 1e3 * old_seconds, 1e9 * old_seconds / npixels);
+	std::printf("decodeBMP:    %8.3f ms, %.2f ns/pixel\n", 1e3 * new_seconds, 1e9 * new_seconds / npixels);
+	std::printf("%.1fx faster\n", old_seconds / new_seconds);
+	return 0;
+}
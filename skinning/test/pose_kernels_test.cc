@@ -0,0 +1,225 @@
+/*
+ * Checks the batched pose kernels against the glm code they replace, for
+ * every batch size up to a few vectors of lanes so the partial batches at
+ * the end are covered too. Exits with 1 if any result is off by more than
+ * its tolerance.
+ */
+#include "pose_kernels.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+	const size_t kMaxBatch = 35;
+	const float kRoundingTolerance = 2e-6f; // a few ulp of unit quantities
+	const float kSlerpTolerance = 4e-5f;    // documented bound near 180 degrees
+
+	std::mt19937 rng(5);
+	int failures = 0;
+
+	float uniform(float lo, float hi)
+	{
+		return std::uniform_real_distribution<float>(lo, hi)(rng);
+	}
+
+	glm::fquat randomQuat()
+	{
+		return glm::normalize(glm::fquat(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)));
+	}
+
+	glm::vec3 randomVec()
+	{
+		return glm::vec3(uniform(-10, 10), uniform(-10, 10), uniform(-10, 10));
+	}
+
+	float difference(const glm::fquat& a, const glm::fquat& b)
+	{
+		return std::max(std::max(std::abs(a.x - b.x), std::abs(a.y - b.y)),
+		                std::max(std::abs(a.z - b.z), std::abs(a.w - b.w)));
+	}
+
+	float difference(const glm::vec3& a, const glm::vec3& b)
+	{
+		glm::vec3 d = glm::abs(a - b);
+		return std::max(d.x, std::max(d.y, d.z));
+	}
+
+	float difference(const glm::mat4& a, const glm::mat4& b)
+	{
+		float worst = 0.0f;
+		for (int c = 0; c < 4; c++)
+			for (int r = 0; r < 4; r++)
+				worst = std::max(worst, std::abs(a[c][r] - b[c][r]));
+		return worst;
+	}
+
+	/* Relative to the magnitude of the expected value. */
+	void check(const char* kernel, size_t n, size_t i, float error, float scale, float tolerance)
+	{
+		if (error <= tolerance * std::max(1.0f, scale))
+			return;
+		if (failures++ < 20)
+			std::printf("%s, batch of %zu, element %zu: off by %g\n", kernel, n, i, error);
+	}
+
+	/*
+	 * glm::slerp in double precision, so the rounding of the reference
+	 * does not count against the kernels. It does not take the shortest
+	 * path by itself.
+	 */
+	glm::fquat shortestSlerp(const glm::fquat& a, const glm::fquat& b, float t)
+	{
+		glm::dquat da(a.w, a.x, a.y, a.z), db(b.w, b.x, b.y, b.z);
+		if (glm::dot(da, db) < 0.0)
+			db = -db;
+		glm::dquat r = glm::slerp(da, db, double(t));
+		return glm::fquat(float(r.w), float(r.x), float(r.y), float(r.z));
+	}
+
+	void testQuaternions(size_t n)
+	{
+		std::vector<glm::fquat> a(n), b(n), out(n);
+		for (size_t i = 0; i < n; i++) {
+			a[i] = randomQuat();
+			b[i] = randomQuat();
+		}
+
+		std::vector<glm::fquat> scaled(n);
+		for (size_t i = 0; i < n; i++)
+			scaled[i] = a[i] * uniform(0.1f, 10.0f);
+		out = scaled;
+		quatNormalizeBatch(out.data(), n);
+		for (size_t i = 0; i < n; i++)
+			check("quatNormalizeBatch", n, i, difference(out[i], glm::normalize(scaled[i])), 1.0f, kRoundingTolerance);
+		std::vector<glm::fquat> again = out;
+		quatNormalizeBatch(again.data(), n);
+		for (size_t i = 0; i < n; i++)
+			check("quatNormalizeBatch twice", n, i, difference(again[i], out[i]), 1.0f, 0.0f);
+
+		for (float t : { 0.0f, 0.3f, 0.5f, 1.0f }) {
+			quatNlerpBatch(a.data(), b.data(), t, out.data(), n);
+			for (size_t i = 0; i < n; i++) {
+				glm::fquat bb = glm::dot(a[i], b[i]) < 0.0f ? -b[i] : b[i];
+				glm::fquat expected = glm::normalize(a[i] * (1.0f - t) + bb * t);
+				check("quatNlerpBatch", n, i, difference(out[i], expected), 1.0f, kRoundingTolerance);
+			}
+
+			quatSlerpBatch(a.data(), b.data(), t, out.data(), n);
+			for (size_t i = 0; i < n; i++)
+				check("quatSlerpBatch", n, i, difference(out[i], shortestSlerp(a[i], b[i], t)), 1.0f, kSlerpTolerance);
+
+			std::vector<glm::fquat> aligned(n);
+			std::vector<float> cos_minus_one(n);
+			prepareSlerpBatch(a.data(), b.data(), aligned.data(), cos_minus_one.data(), n);
+			quatSlerpPreparedBatch(a.data(), aligned.data(), cos_minus_one.data(), t, out.data(), n);
+			for (size_t i = 0; i < n; i++)
+				check("quatSlerpPreparedBatch", n, i, difference(out[i], shortestSlerp(a[i], b[i], t)), 1.0f, kSlerpTolerance);
+		}
+
+		// Keys close together, as consecutive keyframes usually are, are
+		// held to the tighter bound.
+		for (size_t i = 0; i < n; i++)
+			b[i] = glm::normalize(a[i] * glm::angleAxis(uniform(-1.9f, 1.9f), glm::normalize(randomVec())));
+		quatSlerpBatch(a.data(), b.data(), 0.4f, out.data(), n);
+		for (size_t i = 0; i < n; i++)
+			check("quatSlerpBatch (under 110 degrees)", n, i, difference(out[i], shortestSlerp(a[i], b[i], 0.4f)), 1.0f, 1e-6f);
+
+		// out may alias a.
+		std::vector<glm::fquat> expected(n);
+		for (size_t i = 0; i < n; i++)
+			expected[i] = shortestSlerp(a[i], b[i], 0.7f);
+		quatSlerpBatch(a.data(), b.data(), 0.7f, a.data(), n);
+		for (size_t i = 0; i < n; i++)
+			check("quatSlerpBatch in place", n, i, difference(a[i], expected[i]), 1.0f, 1e-6f);
+	}
+
+	void testMatrices(size_t n)
+	{
+		std::vector<glm::fquat> rot(n);
+		std::vector<glm::vec3> trans(n);
+		std::vector<glm::mat4> affine(n), other(n), product(n);
+		for (size_t i = 0; i < n; i++) {
+			rot[i] = randomQuat();
+			trans[i] = randomVec();
+		}
+		quatToAffineBatch(rot.data(), trans.data(), affine.data(), n);
+		for (size_t i = 0; i < n; i++) {
+			glm::mat4 expected = glm::translate(glm::mat4(1.0f), trans[i]) * glm::mat4_cast(rot[i]);
+			check("quatToAffineBatch", n, i, difference(affine[i], expected), 10.0f, kRoundingTolerance);
+		}
+
+		for (size_t i = 0; i < n; i++)
+			for (int c = 0; c < 4; c++)
+				other[i][c] = glm::vec4(randomVec(), uniform(-1, 1));
+		mat4MultiplyBatch(affine.data(), other.data(), product.data(), n);
+		for (size_t i = 0; i < n; i++)
+			check("mat4MultiplyBatch", n, i, difference(product[i], affine[i] * other[i]), 100.0f, kRoundingTolerance);
+		mat4MultiplyBatch(affine.data(), other.data(), other.data(), n);
+		for (size_t i = 0; i < n; i++)
+			check("mat4MultiplyBatch in place", n, i, difference(product[i], other[i]), 1.0f, 0.0f);
+	}
+
+	/*
+	 * A random tree whose joints are composed level by level, as
+	 * Skeleton::forwardKinematics does, against a joint by joint pass.
+	 */
+	void testCompose(size_t n)
+	{
+		size_t njoints = n + 1;
+		std::vector<int> parent(njoints, -1);
+		std::vector<int> depth(njoints, 0);
+		for (size_t i = 1; i < njoints; i++) {
+			parent[i] = int(rng() % i);
+			depth[i] = depth[parent[i]] + 1;
+		}
+		std::vector<glm::fquat> local_rot(njoints), world_rot(njoints), expected_rot(njoints);
+		std::vector<glm::vec3> local_trans(njoints), world_trans(njoints), expected_trans(njoints);
+		for (size_t i = 0; i < njoints; i++) {
+			local_rot[i] = randomQuat();
+			local_trans[i] = randomVec();
+		}
+		world_rot[0] = expected_rot[0] = local_rot[0];
+		world_trans[0] = expected_trans[0] = local_trans[0];
+		for (size_t i = 1; i < njoints; i++) {
+			int p = parent[i];
+			expected_rot[i] = expected_rot[p] * local_rot[i];
+			expected_trans[i] = expected_trans[p] + expected_rot[p] * local_trans[i];
+		}
+		for (int level = 1; ; level++) {
+			std::vector<int> ids;
+			for (size_t i = 0; i < njoints; i++)
+				if (depth[i] == level)
+					ids.push_back(int(i));
+			if (ids.empty())
+				break;
+			composeAffineBatch(ids.data(), ids.size(), parent.data(), local_rot.data(),
+			                   local_trans.data(), world_rot.data(), world_trans.data());
+		}
+		// Errors add up along the chain, so the bound grows with depth.
+		for (size_t i = 0; i < njoints; i++) {
+			float chain = float(depth[i] + 1);
+			check("composeAffineBatch rotation", n, i, difference(world_rot[i], expected_rot[i]), chain, kRoundingTolerance);
+			check("composeAffineBatch translation", n, i, difference(world_trans[i], expected_trans[i]),
+			      10.0f * chain, kRoundingTolerance);
+		}
+	}
+}
+
+int main()
+{
+	std::printf("Pose kernels: %s\n", poseKernelIsa());
+	for (size_t n = 0; n <= kMaxBatch; n++) {
+		testQuaternions(n);
+		testMatrices(n);
+		testCompose(n);
+	}
+	testCompose(1000);
+	if (failures > 0) {
+		std::printf("%d results out of tolerance\n", failures);
+		return 1;
+	}
+	std::printf("All kernels match glm\n");
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Checks that Timeline handles keep naming their keyframe while others
+ * are added and erased, and stop resolving once it is gone, clear()
+ * included. Exits with 1 if any check fails.
+ */
+#include "timeline.h"
+#include <cstdio>
+#include <vector>
+
+namespace {
+	const int kJoints = 4;
+
+	int failures = 0;
+
+	void check(bool ok, const char* what)
+	{
+		if (ok)
+			return;
+		failures++;
+		std::printf("%s\n", what);
+	}
+
+	Timeline::Handle append(Timeline& timeline)
+	{
+		std::vector<glm::fquat> rel_rot(kJoints, glm::fquat(1.0f, 0.0f, 0.0f, 0.0f));
+		return timeline.append(rel_rot.data(), glm::vec3(0.0f));
+	}
+
+	void testErase()
+	{
+		Timeline timeline;
+		timeline.reset(kJoints);
+		Timeline::Handle first = append(timeline);
+		Timeline::Handle second = append(timeline);
+		Timeline::Handle third = append(timeline);
+		timeline.erase(1);
+		check(timeline.indexOf(first) == 0, "first keyframe lost its handle");
+		check(timeline.indexOf(second) == -1, "erased keyframe still resolves");
+		check(timeline.indexOf(third) == 1, "handle did not follow its keyframe");
+		Timeline::Handle reused = append(timeline);
+		check(timeline.indexOf(second) == -1, "erased keyframe resolves once its slot is reused");
+		check(timeline.indexOf(reused) == 2, "handle of a reused slot does not resolve");
+	}
+
+	/*
+	 * Handles taken before clear() fail after it, both of slots only used
+	 * once and of slots reused before the clear().
+	 */
+	void testClear()
+	{
+		Timeline timeline;
+		timeline.reset(kJoints);
+		std::vector<Timeline::Handle> old_handles;
+		for (int i = 0; i < 8; i++)
+			old_handles.push_back(append(timeline));
+		timeline.erase(2, 3);
+		for (int i = 0; i < 3; i++)
+			old_handles.push_back(append(timeline));
+
+		for (int round = 0; round < 1000; round++) {
+			timeline.clear();
+			for (Timeline::Handle handle : old_handles)
+				check(timeline.indexOf(handle) == -1, "handle from before clear() still resolves");
+			std::vector<Timeline::Handle> handles;
+			for (int i = 0; i < 12; i++)
+				handles.push_back(append(timeline));
+			for (Timeline::Handle handle : old_handles)
+				check(timeline.indexOf(handle) == -1, "handle from before clear() resolves to a new keyframe");
+			for (int i = 0; i < 12; i++)
+				check(timeline.indexOf(handles[i]) == i, "handle made after clear() does not resolve");
+			if (failures)
+				return;
+			old_handles.insert(old_handles.end(), handles.begin(), handles.end());
+		}
+	}
+}
+
+int main()
+{
+	testErase();
+	testClear();
+	if (failures) {
+		std::printf("%d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("Handles resolve to their keyframes\n");
+	return 0;
+}